@@ -0,0 +1,111 @@
+#include <tuple.h>
+#include <expr.h>
+#include <rowstore.h>
+#include <aggfuncs.h>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <cstdlib>
+#include <new>
+#include <ctime>
+using namespace std;
+
+/*
+ * Counts heap allocations per input row of projections and of a Q6 style
+ * filtered SUM(price * discount), both through nextTuple() and through
+ * nextBatch(). Only reading the plan is counted, not building its input,
+ * so once buffers are set up the steady state should be close to 0.
+ */
+
+const size_t rows = 1000000;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static vector<TupleP> lineTable();
+static unique_ptr<ExecNode> projection(bool filtered);
+static unique_ptr<ExecNode> filteredSum();
+static void measure(const string &name, const function<unique_ptr<ExecNode>()> &plan,
+                    bool batches);
+
+int main() {
+    cout << fixed << setprecision(3);
+    cout << "plan\t\t\tpath\tallocs/row\ttime (s)" << endl;
+    for (bool batches: { false, true }) {
+        measure("project", []() { return projection(false); }, batches);
+        measure("filter, project", []() { return projection(true); }, batches);
+        measure("filter, sum", filteredSum, batches);
+    }
+    return 0;
+}
+
+/* (price, discount, shipmode) */
+static vector<TupleP> lineTable() {
+    vector<TupleP> result;
+    for (size_t i = 0; i < rows; i++) {
+        TupleP tuple = make_unique<Tuple>();
+        tuple->push_back(make_unique<DoubleDatum>(1000.0 + i % 5000));
+        tuple->push_back(make_unique<DoubleDatum>((i % 11) * 0.01));
+        tuple->push_back(make_unique<StringDatum>(i % 2 ? "MAIL" : "REG AIR"));
+        result.push_back(move(tuple));
+    }
+    return result;
+}
+
+/* price * discount, shipmode, with discount >= 0.05 if filtered */
+static unique_ptr<ExecNode> projection(bool filtered) {
+    unique_ptr<ExecNode> node = make_unique<ExecScan>(lineTable());
+    if (filtered) {
+        node = make_unique<ExecFilter>(move(node),
+            CompareExpr::make(VarExpr::make(1), ConstExpr::makeDecimal(0.05), GTE));
+    }
+    vector<unique_ptr<Expr>> exprs;
+    exprs.push_back(MultExpr::make(VarExpr::make(0), VarExpr::make(1)));
+    exprs.push_back(VarExpr::make(2));
+    return make_unique<ExecProject>(move(node), move(exprs));
+}
+
+/* sum(price * discount) where discount >= 0.05 */
+static unique_ptr<ExecNode> filteredSum() {
+    vector<unique_ptr<AggFuncCall>> aggs;
+    aggs.push_back(AggSum<double>::makeCall(
+        MultExpr::make(VarExpr::make(0), VarExpr::make(1))));
+    return make_unique<ExecAgg>(
+        make_unique<ExecFilter>(make_unique<ExecScan>(lineTable()),
+            CompareExpr::make(VarExpr::make(1), ConstExpr::makeDecimal(0.05), GTE)),
+        vector<int> {}, move(aggs));
+}
+
+static void measure(const string &name, const function<unique_ptr<ExecNode>()> &plan,
+                    bool batches)
+{
+    unique_ptr<ExecNode> node = plan();
+    vector<Tuple *> batch;
+    size_t before = allocations;
+    clock_t start = clock();
+    if (batches) {
+        while (node->nextBatch(batch))
+            ;
+    } else {
+        while (node->nextTuple())
+            ;
+    }
+    double time = (clock() - start) * (1.0 / CLOCKS_PER_SEC);
+    size_t counted = allocations - before;
+    cout << left << setw(24) << name << (batches ? "batch" : "tuple") << "\t"
+         << (double) counted / rows << "\t\t" << time << endl;
+}
@@ -0,0 +1,72 @@
+#include <tuple.h>
+#include <expr.h>
+#include <rowstore.h>
+#include <join.h>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <ctime>
+using namespace std;
+
+/*
+ * Compares simple and interleaved hash join probes for build sides from
+ * cache-resident to much larger than the cache. Half of the probe keys
+ * have a match. It runs anti joins, which return probe rows without copying
+ * them and don't push key filters into the probe side, so the time is
+ * mostly spent in lookups.
+ */
+
+const size_t probeRows = 2000000;
+
+static vector<TupleP> keyTable(const vector<long long> &keys);
+static double probeTime(const vector<long long> &buildKeys,
+                        const vector<long long> &probeKeys, ProbeMode mode);
+
+int main() {
+    mt19937_64 random(42);
+    cout << fixed << setprecision(3);
+    cout << "build rows\tsimple (s)\tinterleaved (s)\tspeedup" << endl;
+    for (size_t buildRows: { 1000, 16000, 256000, 1000000, 4000000 }) {
+        vector<long long> buildKeys, probeKeys;
+        for (size_t i = 0; i < buildRows; i++)
+            buildKeys.push_back(2 * i);
+        for (size_t i = 0; i < probeRows; i++)
+            probeKeys.push_back(random() % (2 * buildRows));
+
+        double simple = probeTime(buildKeys, probeKeys, PROBE_SIMPLE);
+        double interleaved = probeTime(buildKeys, probeKeys, PROBE_INTERLEAVED);
+        cout << buildRows << "\t\t" << simple << "\t\t" << interleaved
+             << "\t\t" << simple / interleaved << endl;
+    }
+    return 0;
+}
+
+static vector<TupleP> keyTable(const vector<long long> &keys) {
+    vector<TupleP> result;
+    for (long long key: keys) {
+        TupleP tuple = make_unique<Tuple>();
+        tuple->push_back(make_unique<BigIntDatum>(key));
+        result.push_back(move(tuple));
+    }
+    return result;
+}
+
+/* time to probe, not counting the build */
+static double probeTime(const vector<long long> &buildKeys,
+                        const vector<long long> &probeKeys, ProbeMode mode)
+{
+    vector<unique_ptr<Expr>> probeExprs, buildExprs;
+    probeExprs.push_back(VarExpr::make(0));
+    buildExprs.push_back(VarExpr::make(0));
+    ExecHashJoin join(make_unique<ExecScan>(keyTable(probeKeys)),
+                      make_unique<ExecScan>(keyTable(buildKeys)),
+                      move(probeExprs), move(buildExprs), JOIN_ANTI, 0, mode);
+
+    /* the first call builds the table */
+    join.nextTuple();
+    clock_t start = clock();
+    while (join.nextTuple())
+        ;
+    clock_t end = clock();
+    return (end - start) * (1.0 / CLOCKS_PER_SEC);
+}
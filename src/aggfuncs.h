@@ -0,0 +1,383 @@
+#ifndef AGGFUNCS_H
+#define AGGFUNCS_H
+
+#include <tuple.h>
+#include <expr.h>
+#include <kernels.h>
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+/*
+ * Aggregate functions keep their per-group state in a block of stateSize()
+ * bytes owned by the caller, so the states of all aggregates of a group can
+ * be laid out in a single allocation. Null inputs are never passed to them.
+ */
+class AggFunc {
+public:
+    virtual ~AggFunc() {}
+    virtual size_t stateSize() const = 0;
+    virtual void init(char *state) = 0;
+    virtual void destroy(char *state) = 0;
+    virtual void aggregate(char *state, const Datum &next) = 0;
+
+    /*
+     * Evaluates expr on each of the rows, and aggregates the result of
+     * rows[i] into the state at (states[i] + offset).
+     */
+    virtual void aggregateBatch(char *const *states, size_t offset, Expr &expr,
+                                Tuple *const *rows, size_t n) = 0;
+
+    /* Same as above, for rows which all belong to the group at state. */
+    virtual void aggregateBatch(char *state, Expr &expr,
+                                Tuple *const *rows, size_t n) = 0;
+    virtual void merge(char *state, const char *other) = 0;
+    virtual DatumP finalize(const char *state) = 0;
+};
+
+class AggFuncCall {
+public:
+    AggFuncCall(std::unique_ptr<AggFunc> func,
+                std::unique_ptr<Expr> expr):
+        func(std::move(func)), expr(std::move(expr)) {}
+
+    size_t stateSize() const {
+        return func->stateSize();
+    }
+
+    void init(char *state) {
+        func->init(state);
+    }
+
+    void destroy(char *state) {
+        func->destroy(state);
+    }
+
+    void aggregate(char *state, const Tuple& next) {
+        Datum *value = expr->eval(next);
+        if (!value->isNull())
+            func->aggregate(state, *value);
+    }
+
+    void aggregateBatch(char *const *states, size_t offset,
+                        Tuple *const *rows, size_t n)
+    {
+        func->aggregateBatch(states, offset, *expr, rows, n);
+    }
+
+    void aggregateBatch(char *state, Tuple *const *rows, size_t n) {
+        func->aggregateBatch(state, *expr, rows, n);
+    }
+
+    void merge(char *state, const char *other) {
+        func->merge(state, other);
+    }
+
+    void addResult(const char *state, Tuple &tuple) {
+        tuple.push_back(func->finalize(state));
+    }
+
+    std::unique_ptr<Expr> &getExpr() { return expr; }
+
+private:
+    std::unique_ptr<AggFunc> func;
+    std::unique_ptr<Expr> expr;
+};
+
+/*
+ * Base of aggregates whose state is a plain typed struct. Impl provides
+ * static initState, updateState, updateColumn, mergeState and finalizeState
+ * functions on the State type, which both the row and the batch paths call
+ * directly, so the batch path dispatches to the aggregate once per batch
+ * rather than once per row.
+ *
+ * When all rows of a batch belong to the same group, input values are
+ * first gathered into a column, which updateColumn reduces with the
+ * kernels in kernels.h.
+ */
+template <class Impl, class State, class Input>
+class TypedAggFunc: public AggFunc {
+public:
+    size_t stateSize() const override {
+        return sizeof(State);
+    }
+
+    void init(char *state) override {
+        Impl::initState(*new (state) State());
+    }
+
+    void destroy(char *state) override {
+        stateOf(state).~State();
+    }
+
+    void aggregate(char *state, const Datum &next) override {
+        Impl::updateState(stateOf(state), datumValue<Input>(next));
+    }
+
+    void aggregateBatch(char *const *states, size_t offset, Expr &expr,
+                        Tuple *const *rows, size_t n) override
+    {
+        for (size_t i = 0; i < n; i++) {
+            const Datum *value = expr.eval(*rows[i]);
+            if (value->isNull())
+                continue;
+            auto *boxed = static_cast<const BoxedDatum<Input> *>(value);
+            Impl::updateState(stateOf(states[i] + offset), boxed->value);
+        }
+    }
+
+    void aggregateBatch(char *state, Expr &expr,
+                        Tuple *const *rows, size_t n) override
+    {
+        column.clear();
+        for (size_t i = 0; i < n; i++) {
+            const Datum *value = expr.eval(*rows[i]);
+            if (!value->isNull())
+                column.push_back(static_cast<const BoxedDatum<Input> *>(value)->value);
+        }
+        Impl::updateColumn(stateOf(state), column.data(), column.size());
+    }
+
+    void merge(char *state, const char *other) override {
+        Impl::mergeState(stateOf(state), stateOf(other));
+    }
+
+    DatumP finalize(const char *state) override {
+        return Impl::finalizeState(stateOf(state));
+    }
+
+protected:
+    static State &stateOf(char *state) {
+        return *reinterpret_cast<State *>(state);
+    }
+
+    static const State &stateOf(const char *state) {
+        return *reinterpret_cast<const State *>(state);
+    }
+
+private:
+    std::vector<Input> column;
+};
+
+template <class inputType>
+class AggSum: public TypedAggFunc<AggSum<inputType>, inputType, inputType> {
+public:
+    static void initState(inputType &sum) {
+        sum = 0;
+    }
+
+    static void updateState(inputType &sum, const inputType &next) {
+        sum += next;
+    }
+
+    static void updateColumn(inputType &sum, const inputType *values, size_t n) {
+        sum += sumKernel(values, n);
+    }
+
+    static void mergeState(inputType &sum, const inputType &other) {
+        sum += other;
+    }
+
+    static DatumP finalizeState(const inputType &sum) {
+        return std::make_unique<NumericDatum<inputType>>(sum);
+    }
+
+    static std::unique_ptr<AggFuncCall> makeCall(std::unique_ptr<Expr> expr) {
+        return std::make_unique<AggFuncCall>(
+                    std::make_unique<AggSum<inputType>>(),
+                    std::move(expr));
+    }
+};
+
+/* COUNT(expr) counts non-null values, COUNT(*) counts rows. */
+class AggCount: public AggFunc {
+public:
+    size_t stateSize() const override {
+        return sizeof(long long);
+    }
+
+    void init(char *state) override {
+        countOf(state) = 0;
+    }
+
+    void destroy(char *state) override {}
+
+    void aggregate(char *state, const Datum &next) override {
+        countOf(state)++;
+    }
+
+    void aggregateBatch(char *const *states, size_t offset, Expr &expr,
+                        Tuple *const *rows, size_t n) override
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (!expr.eval(*rows[i])->isNull())
+                countOf(states[i] + offset)++;
+        }
+    }
+
+    void aggregateBatch(char *state, Expr &expr,
+                        Tuple *const *rows, size_t n) override
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (!expr.eval(*rows[i])->isNull())
+                countOf(state)++;
+        }
+    }
+
+    void merge(char *state, const char *other) override {
+        countOf(state) += *reinterpret_cast<const long long *>(other);
+    }
+
+    DatumP finalize(const char *state) override {
+        return std::make_unique<BigIntDatum>(*reinterpret_cast<const long long *>(state));
+    }
+
+    static std::unique_ptr<AggFuncCall> makeCall(std::unique_ptr<Expr> expr) {
+        return std::make_unique<AggFuncCall>(std::make_unique<AggCount>(),
+                                             std::move(expr));
+    }
+
+    /* COUNT(*) is the count of a constant which is never null */
+    static std::unique_ptr<AggFuncCall> makeStarCall() {
+        return makeCall(ConstExpr::makeBoxed<bool>(true));
+    }
+
+private:
+    static long long &countOf(char *state) {
+        return *reinterpret_cast<long long *>(state);
+    }
+};
+
+template <class valueType>
+struct MinMaxState {
+    bool valid = false;
+    valueType value;
+};
+
+template <class valueType, bool isMax>
+class AggMinMax: public TypedAggFunc<AggMinMax<valueType, isMax>,
+                                     MinMaxState<valueType>, valueType> {
+public:
+    typedef MinMaxState<valueType> State;
+
+    static void initState(State &state) {}
+
+    static void updateState(State &state, const valueType &next) {
+        if (!state.valid || (isMax ? state.value < next : next < state.value)) {
+            state.value = next;
+            state.valid = true;
+        }
+    }
+
+    static void updateColumn(State &state, const valueType *values, size_t n) {
+        if (n == 0)
+            return;
+        if (!state.valid) {
+            state.value = values[0];
+            state.valid = true;
+        }
+        if constexpr (std::is_arithmetic<valueType>::value) {
+            state.value = isMax ? maxKernel(values, n, state.value)
+                                : minKernel(values, n, state.value);
+        } else {
+            for (size_t i = 0; i < n; i++)
+                updateState(state, values[i]);
+        }
+    }
+
+    static void mergeState(State &state, const State &other) {
+        if (other.valid)
+            updateState(state, other.value);
+    }
+
+    static DatumP finalizeState(const State &state) {
+        if (!state.valid)
+            return std::make_unique<NullDatum>();
+        return makeDatum<valueType>(state.value);
+    }
+
+    static std::unique_ptr<AggFuncCall> makeCall(std::unique_ptr<Expr> expr) {
+        return std::make_unique<AggFuncCall>(
+                    std::make_unique<AggMinMax<valueType, isMax>>(),
+                    std::move(expr));
+    }
+};
+
+template <class valueType>
+using AggMin = AggMinMax<valueType, false>;
+
+template <class valueType>
+using AggMax = AggMinMax<valueType, true>;
+
+struct AvgState {
+    double sum = 0;
+    long long count = 0;
+};
+
+template <class inputType>
+class AggAvg: public TypedAggFunc<AggAvg<inputType>, AvgState, inputType> {
+public:
+    static void initState(AvgState &state) {}
+
+    static void updateState(AvgState &state, const inputType &next) {
+        state.sum += next;
+        state.count++;
+    }
+
+    /* added up as doubles, as by updateState(), so integers don't overflow */
+    static void updateColumn(AvgState &state, const inputType *values, size_t n) {
+        state.sum += sumKernel<inputType, double>(values, n);
+        state.count += n;
+    }
+
+    static void mergeState(AvgState &state, const AvgState &other) {
+        state.sum += other.sum;
+        state.count += other.count;
+    }
+
+    static DatumP finalizeState(const AvgState &state) {
+        if (state.count == 0)
+            return std::make_unique<NullDatum>();
+        return std::make_unique<DoubleDatum>(state.sum / state.count);
+    }
+
+    static std::unique_ptr<AggFuncCall> makeCall(std::unique_ptr<Expr> expr) {
+        return std::make_unique<AggFuncCall>(
+                    std::make_unique<AggAvg<inputType>>(),
+                    std::move(expr));
+    }
+};
+
+/*
+ * SUM of doubles whose result is bit-identical however rows are batched,
+ * ordered or merged. Slower than AggSum<double> and with a larger state,
+ * use it where results must be reproducible.
+ */
+class AggDeterministicSum: public TypedAggFunc<AggDeterministicSum, DeterministicSum, double> {
+public:
+    static void initState(DeterministicSum &state) {}
+
+    static void updateState(DeterministicSum &state, const double &next) {
+        state.add(next);
+    }
+
+    static void updateColumn(DeterministicSum &state, const double *values, size_t n) {
+        state.add(values, n);
+    }
+
+    static void mergeState(DeterministicSum &state, const DeterministicSum &other) {
+        state.merge(other);
+    }
+
+    static DatumP finalizeState(const DeterministicSum &state) {
+        return std::make_unique<DoubleDatum>(state.result());
+    }
+
+    static std::unique_ptr<AggFuncCall> makeCall(std::unique_ptr<Expr> expr) {
+        return std::make_unique<AggFuncCall>(std::make_unique<AggDeterministicSum>(),
+                                             std::move(expr));
+    }
+};
+
+#endif
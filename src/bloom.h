@@ -0,0 +1,53 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Register-blocked Bloom filter over 64-bit hashes. All the bits of a key
+ * are set in a single 64-bit word, so a lookup is one memory access and a
+ * mask comparison. The high half of the hash picks the word and the low
+ * bits pick bitsPerKey bit positions in it, so hashes must be well mixed.
+ */
+class BloomFilter {
+public:
+    static constexpr int bitsPerKey = 4;
+
+    /* sized for about 16 bits per key, which gives a few percent false positives */
+    explicit BloomFilter(size_t keys = 0) {
+        size_t words = 1;
+        while (words * 64 < keys * 16)
+            words *= 2;
+        blocks.assign(words, 0);
+        wordMask = words - 1;
+    }
+
+    void add(size_t hash) {
+        blocks[wordOf(hash)] |= maskOf(hash);
+    }
+
+    /* false if no key with this hash was added */
+    bool mayContain(size_t hash) const {
+        uint64_t mask = maskOf(hash);
+        return (blocks[wordOf(hash)] & mask) == mask;
+    }
+
+private:
+    std::vector<uint64_t> blocks;
+    size_t wordMask;
+
+    size_t wordOf(size_t hash) const {
+        return (hash >> 32) & wordMask;
+    }
+
+    static uint64_t maskOf(size_t hash) {
+        uint64_t mask = 0;
+        for (int i = 0; i < bitsPerKey; i++)
+            mask |= 1ULL << ((hash >> (6 * i)) & 63);
+        return mask;
+    }
+};
+
+#endif
@@ -2,13 +2,23 @@
 #define DATETIME_H
 
 #include <iostream>
+#include <functional>
 
 struct Date {
     int year, month, day;
+    Date(): year(0), month(0), day(0) {}
     Date(int year, int month, int day): year(year), month(month), day(day) {}
     bool operator<(const Date &b) const;
     bool operator==(const Date &b) const;
     friend std::ostream &operator<<(std::ostream &output, const Date &d);
 };
 
+namespace std {
+template <> struct hash<Date> {
+    size_t operator()(const Date &d) const {
+        return hash<int>()((d.year * 16 + d.month) * 32 + d.day);
+    }
+};
+}
+
 #endif
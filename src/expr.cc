@@ -0,0 +1,466 @@
+#include <expr.h>
+#include <typeinfo>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <map>
+using namespace std;
+
+static unique_ptr<Expr> foldConstant(Expr &expr);
+static bool isLowerBound(CompareOp op);
+static bool isUpperBound(CompareOp op);
+static CompareOp flipCompareOp(CompareOp op);
+static CompareKernel compareKernelFor(const Datum &value);
+template <class T>
+static unique_ptr<Expr> makeTypedColumnCompare(int column, CompareOp op, const Datum &constant);
+template <class T>
+static unique_ptr<Expr> makeTypedColumnIn(int column, const vector<const Datum *> &values);
+template <class T>
+static unique_ptr<Expr> makeTypedBetween(int column, const Datum &low, bool lowInclusive,
+                                         const Datum &high, bool highInclusive);
+static void findSubexprs(unique_ptr<Expr> &expr,
+                         map<string, vector<unique_ptr<Expr> *>> &occurrences);
+
+void simplifyExpr(unique_ptr<Expr> &expr) {
+    if (unique_ptr<Expr> simplified = expr->simplify())
+        expr = move(simplified);
+}
+
+/* ArithExpr */
+unique_ptr<Expr> ArithExpr::simplify() {
+    simplifyExpr(left);
+    simplifyExpr(right);
+    if (left->constantValue() && right->constantValue())
+        return foldConstant(*this);
+    return NULL;
+}
+
+/* CompareExpr */
+unique_ptr<Expr> CompareExpr::simplify() {
+    simplifyExpr(left);
+    simplifyExpr(right);
+    if (left->constantValue() && right->constantValue())
+        return foldConstant(*this);
+    int column;
+    CompareOp columnOp;
+    const Datum *value;
+    if (columnBound(column, columnOp, value))
+        return makeColumnCompare(column, columnOp, *value);
+    return NULL;
+}
+
+/*
+ * Binds the kernel for the type of the operands if neither is NULL, and
+ * compares them. Operands of different types, or of a type without a
+ * kernel, are compared with Datum::operator<(), the same as before.
+ */
+int CompareExpr::bindKernel(const Datum &left, const Datum &right) {
+    if (left.isNull() || right.isNull())
+        return (int) right.isNull() - (int) left.isNull();
+    if (typeid(left) == typeid(right) && (kernel = compareKernelFor(left)))
+        return kernel(left, right);
+    kernel = [](const Datum &a, const Datum &b) { return a < b ? -1 : (b < a ? 1 : 0); };
+    return kernel(left, right);
+}
+
+bool CompareExpr::columnBound(int &column, CompareOp &op, const Datum *&value) const {
+    auto *leftVar = dynamic_cast<const VarExpr *>(left.get());
+    auto *rightVar = dynamic_cast<const VarExpr *>(right.get());
+    if (leftVar && right->constantValue()) {
+        column = leftVar->getIndex();
+        op = this->op;
+        value = right->constantValue();
+        return true;
+    }
+    if (rightVar && left->constantValue()) {
+        column = rightVar->getIndex();
+        op = flipCompareOp(this->op);
+        value = left->constantValue();
+        return true;
+    }
+    return false;
+}
+
+/* AndExpr */
+
+/*
+ * Conjuncts are simplified one by one, dropping TRUE ones, and the whole
+ * conjunction is FALSE if one of them is. Then each lower bound on a column
+ * is paired with the first upper bound on the same column into a
+ * BetweenExpr, and the rest is chained with ANDs again, in the same order.
+ */
+unique_ptr<Expr> AndExpr::simplify() {
+    vector<unique_ptr<Expr>> operands;
+    takeConjuncts(move(left), operands);
+    takeConjuncts(move(right), operands);
+
+    vector<unique_ptr<Expr>> kept;
+    for (unique_ptr<Expr> &conjunct: operands) {
+        simplifyExpr(conjunct);
+        if (const Datum *value = conjunct->constantValue()) {
+            if (!static_cast<const BoolDatum *>(value)->value)
+                return move(conjunct);
+            continue;
+        }
+        kept.push_back(move(conjunct));
+    }
+
+    for (size_t i = 0; i < kept.size(); i++) {
+        int column;
+        CompareOp lowOp;
+        const Datum *low;
+        if (!kept[i]->columnBound(column, lowOp, low) || !isLowerBound(lowOp))
+            continue;
+        for (size_t j = 0; j < kept.size(); j++) {
+            int upperColumn;
+            CompareOp highOp;
+            const Datum *high;
+            if (!kept[j]->columnBound(upperColumn, highOp, high) ||
+                upperColumn != column || !isUpperBound(highOp))
+                continue;
+            if (auto between = makeBetween(column, *low, lowOp == GTE, *high, highOp == LTE)) {
+                kept[i] = move(between);
+                kept.erase(kept.begin() + j);
+                if (j < i)
+                    i--;
+                break;
+            }
+        }
+    }
+
+    if (kept.empty())
+        return ConstExpr::makeBoxed<bool>(true);
+    unique_ptr<Expr> result = move(kept[0]);
+    for (size_t i = 1; i < kept.size(); i++)
+        result = AndExpr::make(move(result), move(kept[i]));
+    return result;
+}
+
+/* moves the operands of nested ANDs in expr into conjuncts, from left to right */
+void AndExpr::takeConjuncts(unique_ptr<Expr> expr, vector<unique_ptr<Expr>> &conjuncts) {
+    if (auto *conjunction = dynamic_cast<AndExpr *>(expr.get())) {
+        takeConjuncts(move(conjunction->left), conjuncts);
+        takeConjuncts(move(conjunction->right), conjuncts);
+    } else {
+        conjuncts.push_back(move(expr));
+    }
+}
+
+size_t AndExpr::select(Tuple **rows, size_t n) {
+    if (conjuncts.empty())
+        addConjuncts(*this);
+    for (Conjunct &conjunct: conjuncts) {
+        if (n == 0)
+            break;
+        auto start = chrono::steady_clock::now();
+        size_t selected = conjunct.expr->select(rows, n);
+        auto time = chrono::steady_clock::now() - start;
+        conjunct.rowsIn += n;
+        conjunct.rowsSinceRank += n;
+        conjunct.rowsOut += selected;
+        conjunct.nanoseconds += chrono::duration<double, nano>(time).count();
+        n = selected;
+    }
+    if (++batches % rankInterval == 0)
+        rankConjuncts();
+    return n;
+}
+
+/* adds the operands of the chain of ANDs at expr, from left to right */
+void AndExpr::addConjuncts(Expr &expr) {
+    if (auto *conjunction = dynamic_cast<AndExpr *>(&expr)) {
+        addConjuncts(*conjunction->left);
+        addConjuncts(*conjunction->right);
+    } else {
+        conjuncts.push_back(Conjunct { &expr, 0, 0, 0, 0 });
+    }
+}
+
+/*
+ * Conjuncts without statistics go first, so they are measured, and those
+ * which drop no rows go last. Halving the statistics doesn't change the
+ * ranking by itself, but makes each interval count twice as much as the
+ * one before, so the order follows changes in the data. Conjuncts which
+ * saw no rows in the interval, because those before them dropped all
+ * rows, lose their statistics, so they are measured again next time.
+ */
+void AndExpr::rankConjuncts() {
+    for (Conjunct &conjunct: conjuncts) {
+        if (conjunct.rowsSinceRank == 0) {
+            conjunct.rowsIn = conjunct.rowsOut = conjunct.nanoseconds = 0;
+        } else {
+            conjunct.rowsIn /= 2;
+            conjunct.rowsOut /= 2;
+            conjunct.nanoseconds /= 2;
+        }
+        conjunct.rowsSinceRank = 0;
+    }
+    auto rank = [](const Conjunct &conjunct) {
+        if (conjunct.rowsIn == 0)
+            return 0.0;
+        double dropped = 1 - conjunct.rowsOut / conjunct.rowsIn;
+        if (dropped <= 0)
+            return HUGE_VAL;
+        return conjunct.nanoseconds / conjunct.rowsIn / dropped;
+    };
+    stable_sort(conjuncts.begin(), conjuncts.end(), [&](const Conjunct &a, const Conjunct &b) {
+        return rank(a) < rank(b);
+    });
+}
+
+/* OrExpr */
+unique_ptr<Expr> OrExpr::simplify() {
+    simplifyExpr(left);
+    simplifyExpr(right);
+    if (const Datum *value = left->constantValue())
+        return static_cast<const BoolDatum *>(value)->value ? move(left) : move(right);
+    if (const Datum *value = right->constantValue())
+        return static_cast<const BoolDatum *>(value)->value ? move(right) : move(left);
+    return NULL;
+}
+
+/* NotExpr */
+unique_ptr<Expr> NotExpr::simplify() {
+    simplifyExpr(child);
+    if (child->constantValue())
+        return foldConstant(*this);
+    if (auto *negated = dynamic_cast<NotExpr *>(child.get()))
+        return move(negated->child);
+    return NULL;
+}
+
+/* ColumnCompareExpr */
+unique_ptr<Expr> makeColumnCompare(int column, CompareOp op, const Datum &constant) {
+    if (typeid(constant) == typeid(IntDatum))
+        return makeTypedColumnCompare<int>(column, op, constant);
+    if (typeid(constant) == typeid(BigIntDatum))
+        return makeTypedColumnCompare<long long>(column, op, constant);
+    if (typeid(constant) == typeid(DoubleDatum))
+        return makeTypedColumnCompare<double>(column, op, constant);
+    if (typeid(constant) == typeid(DateDatum))
+        return makeTypedColumnCompare<Date>(column, op, constant);
+    if (typeid(constant) == typeid(StringDatum))
+        return makeTypedColumnCompare<string>(column, op, constant);
+    return NULL;
+}
+
+template <class T>
+static unique_ptr<Expr> makeTypedColumnCompare(int column, CompareOp op, const Datum &constant) {
+    switch (op) {
+        case LT:
+            return make_unique<ColumnCompareExpr<T, LT>>(column, constant);
+        case LTE:
+            return make_unique<ColumnCompareExpr<T, LTE>>(column, constant);
+        case EQ:
+            return make_unique<ColumnCompareExpr<T, EQ>>(column, constant);
+        case GTE:
+            return make_unique<ColumnCompareExpr<T, GTE>>(column, constant);
+        case GT:
+            return make_unique<ColumnCompareExpr<T, GT>>(column, constant);
+    }
+    return NULL;
+}
+
+static CompareKernel compareKernelFor(const Datum &value) {
+    if (typeid(value) == typeid(IntDatum))
+        return compareDatums<int>;
+    if (typeid(value) == typeid(BigIntDatum))
+        return compareDatums<long long>;
+    if (typeid(value) == typeid(DoubleDatum))
+        return compareDatums<double>;
+    if (typeid(value) == typeid(DateDatum))
+        return compareDatums<Date>;
+    if (typeid(value) == typeid(StringDatum))
+        return compareDatums<string>;
+    if (typeid(value) == typeid(BoolDatum))
+        return compareDatums<bool>;
+    return NULL;
+}
+
+/* InExpr */
+unique_ptr<Expr> InExpr::simplify() {
+    simplifyExpr(value);
+    vector<const Datum *> constants;
+    bool allConstant = true;
+    for (auto &item: list) {
+        simplifyExpr(item);
+        const Datum *constant = item->constantValue();
+        if (!constant)
+            allConstant = false;
+        else if (!constant->isNull())
+            constants.push_back(constant);
+    }
+    if (!allConstant)
+        return NULL;
+    /* NULLs match nothing */
+    if (constants.empty())
+        return ConstExpr::makeBoxed<bool>(false);
+    if (value->constantValue())
+        return foldConstant(*this);
+    if (auto *var = dynamic_cast<const VarExpr *>(value.get()))
+        return makeColumnIn(var->getIndex(), constants);
+    return NULL;
+}
+
+/* ColumnInExpr */
+unique_ptr<Expr> makeColumnIn(int column, const vector<const Datum *> &values) {
+    for (const Datum *value: values) {
+        if (typeid(*value) != typeid(*values.front()))
+            return NULL;
+    }
+    const Datum &first = *values.front();
+    if (typeid(first) == typeid(IntDatum))
+        return makeTypedColumnIn<int>(column, values);
+    if (typeid(first) == typeid(BigIntDatum))
+        return makeTypedColumnIn<long long>(column, values);
+    if (typeid(first) == typeid(DoubleDatum))
+        return makeTypedColumnIn<double>(column, values);
+    if (typeid(first) == typeid(DateDatum))
+        return makeTypedColumnIn<Date>(column, values);
+    if (typeid(first) == typeid(StringDatum))
+        return makeTypedColumnIn<string>(column, values);
+    return NULL;
+}
+
+template <class T>
+static unique_ptr<Expr> makeTypedColumnIn(int column, const vector<const Datum *> &values) {
+    vector<T> list;
+    for (const Datum *value: values)
+        list.push_back(static_cast<const BoxedDatum<T> *>(value)->value);
+    return make_unique<ColumnInExpr<T>>(column, move(list));
+}
+
+/* BetweenExpr */
+unique_ptr<Expr> makeBetween(int column, const Datum &low, bool lowInclusive,
+                             const Datum &high, bool highInclusive)
+{
+    if (typeid(low) != typeid(high))
+        return NULL;
+    if (typeid(low) == typeid(IntDatum))
+        return makeTypedBetween<int>(column, low, lowInclusive, high, highInclusive);
+    if (typeid(low) == typeid(BigIntDatum))
+        return makeTypedBetween<long long>(column, low, lowInclusive, high, highInclusive);
+    if (typeid(low) == typeid(DoubleDatum))
+        return makeTypedBetween<double>(column, low, lowInclusive, high, highInclusive);
+    if (typeid(low) == typeid(DateDatum))
+        return makeTypedBetween<Date>(column, low, lowInclusive, high, highInclusive);
+    if (typeid(low) == typeid(StringDatum))
+        return makeTypedBetween<string>(column, low, lowInclusive, high, highInclusive);
+    return NULL;
+}
+
+template <class T>
+static unique_ptr<Expr> makeTypedBetween(int column, const Datum &low, bool lowInclusive,
+                                         const Datum &high, bool highInclusive)
+{
+    return make_unique<BetweenExpr<T>>(
+        column, static_cast<const BoxedDatum<T> &>(low).value, lowInclusive,
+        static_cast<const BoxedDatum<T> &>(high).value, highInclusive);
+}
+
+/* CommonExprs */
+size_t CommonExprs::add(unique_ptr<Expr> expr) {
+    auto slot = make_unique<Slot>();
+    slot->expr = move(expr);
+    slot->entries.resize(1 << tableBits);
+    slots.push_back(move(slot));
+    return slots.size() - 1;
+}
+
+Datum *CommonExprs::eval(size_t slot, const Tuple &tuple) {
+    Slot &s = *slots[slot];
+    size_t hash = (reinterpret_cast<uintptr_t>(&tuple) * 0x9e3779b97f4a7c15ull) >> (64 - tableBits);
+    for (size_t probe = 0; probe < maxProbes; probe++) {
+        Entry &entry = s.entries[(hash + probe) & ((1 << tableBits) - 1)];
+        if (entry.generation != generation) {
+            entry.row = &tuple;
+            entry.generation = generation;
+            s.expr->eval(tuple)->copyTo(entry.value);
+            return entry.value.get();
+        }
+        if (entry.row == &tuple)
+            return entry.value.get();
+    }
+    return s.expr->eval(tuple);
+}
+
+/*
+ * Each round shares the largest subexpression with more than one
+ * occurrence, including those in the subexpressions shared so far, so a
+ * smaller one which also occurs elsewhere is shared in a later round.
+ */
+shared_ptr<CommonExprs> shareCommonExprs(const vector<unique_ptr<Expr> *> &exprs) {
+    shared_ptr<CommonExprs> common;
+    vector<unique_ptr<Expr> *> roots = exprs;
+    while (true) {
+        map<string, vector<unique_ptr<Expr> *>> occurrences;
+        for (unique_ptr<Expr> *root: roots)
+            findSubexprs(*root, occurrences);
+        const vector<unique_ptr<Expr> *> *largest = NULL;
+        size_t largestKey = 0;
+        for (auto &p: occurrences) {
+            if (p.second.size() > 1 && p.first.size() > largestKey) {
+                largest = &p.second;
+                largestKey = p.first.size();
+            }
+        }
+        if (!largest)
+            return common;
+        if (!common)
+            common = make_shared<CommonExprs>();
+        size_t slot = common->add(move(*(*largest)[0]));
+        for (unique_ptr<Expr> *place: *largest)
+            *place = make_unique<SharedExpr>(common, slot);
+        roots.push_back(&common->getExpr(slot));
+    }
+}
+
+/*
+ * Adds the places of the subexpressions of expr which have operands and a
+ * key, operands first. So if an expression has the same key as one of its
+ * operands, the operand is replaced before the expression which holds it.
+ */
+static void findSubexprs(unique_ptr<Expr> &expr,
+                         map<string, vector<unique_ptr<Expr> *>> &occurrences)
+{
+    bool hasOperands = false;
+    expr->visitChildren([&](unique_ptr<Expr> &child) {
+        hasOperands = true;
+        findSubexprs(child, occurrences);
+    });
+    string key;
+    if (hasOperands && expr->writeKey(key))
+        occurrences[key].push_back(&expr);
+}
+
+/* a ConstExpr of the value of an expression whose operands are all constant */
+static unique_ptr<Expr> foldConstant(Expr &expr) {
+    Tuple empty;
+    DatumP value;
+    expr.eval(empty)->copyTo(value);
+    return make_unique<ConstExpr>(move(value));
+}
+
+static bool isLowerBound(CompareOp op) {
+    return op == GT || op == GTE;
+}
+
+static bool isUpperBound(CompareOp op) {
+    return op == LT || op == LTE;
+}
+
+/* the op which gives the same result with the operands swapped */
+static CompareOp flipCompareOp(CompareOp op) {
+    switch (op) {
+        case LT:
+            return GT;
+        case LTE:
+            return GTE;
+        case GTE:
+            return LTE;
+        case GT:
+            return LT;
+        default:
+            return op;
+    }
+}
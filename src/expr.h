@@ -4,12 +4,79 @@
 #include <tuple.h>
 #include <vector>
 #include <memory>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <unordered_set>
+#include <type_traits>
+
+class Expr;
+typedef std::function<void(std::unique_ptr<Expr> &)> ExprVisitor;
+
+enum CompareOp {
+    LT,
+    LTE,
+    EQ,
+    GTE,
+    GT
+};
 
 class Expr {
 public:
+    virtual ~Expr() {}
     virtual Datum *eval(const Tuple &tuple) = 0;
+
+    /*
+     * Simplifies the children of the expression in place, and returns an
+     * equivalent expression to replace it with, or NULL to keep it.
+     */
+    virtual std::unique_ptr<Expr> simplify() { return NULL; }
+
+    /* the value of a constant expression, or NULL if it depends on the row */
+    virtual const Datum *constantValue() const { return NULL; }
+
+    /* calls visit on each operand, which may replace it */
+    virtual void visitChildren(const ExprVisitor &visit) {}
+
+    /*
+     * Appends a key to out which is the same for expressions which give
+     * the same results on the same rows, and returns true. Expressions
+     * without a key return false, and are never shared by
+     * shareCommonExprs().
+     */
+    virtual bool writeKey(std::string &out) const { return false; }
+
+    /*
+     * If this compares a column with a constant, sets column, value and
+     * the op with the column on the left, e.g. GT for 5 < x, and returns
+     * true.
+     */
+    virtual bool columnBound(int &column, CompareOp &op, const Datum *&value) const {
+        return false;
+    }
+
+    /*
+     * Moves the rows of a batch for which the expression is true to the
+     * front, in their order, and returns their count.
+     */
+    virtual size_t select(Tuple **rows, size_t n) {
+        size_t selected = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (static_cast<const BoolDatum *>(eval(*rows[i]))->value)
+                rows[selected++] = rows[i];
+        }
+        return selected;
+    }
 };
 
+/*
+ * Optimizer pass which folds constant subexpressions, drops TRUE and FALSE
+ * from AND and OR, removes double NOTs, rewrites lower and upper bounds
+ * on the same column in a conjunction into a BetweenExpr, and specializes
+ * comparisons and IN lists of a column with constants for their type.
+ */
+void simplifyExpr(std::unique_ptr<Expr> &expr);
+
 class ConstExpr: public Expr {
 public:
     ConstExpr(std::unique_ptr<Datum> val): val(std::move(val)) {}
@@ -17,6 +84,14 @@ public:
         return val.get();
     }
 
+    const Datum *constantValue() const override { return val.get(); }
+
+    bool writeKey(std::string &out) const override {
+        out += 'c';
+        val->write(out);
+        return true;
+    }
+
     static std::unique_ptr<ConstExpr> makeInt(int value) {
         return std::make_unique<ConstExpr>(std::make_unique<IntDatum>(value));
     }
@@ -40,6 +115,14 @@ public:
         return tuple[varIndex].get();
     }
 
+    int getIndex() const { return varIndex; }
+
+    bool writeKey(std::string &out) const override {
+        out += 'v';
+        writeValue(out, varIndex);
+        return true;
+    }
+
     static std::unique_ptr<VarExpr> make(int attr) {
         return std::make_unique<VarExpr>(attr);
     }
@@ -47,71 +130,124 @@ private:
     int varIndex;
 };
 
-class MultExpr: public Expr {
+/* left + right, left - right or left * right, of two values of the same type */
+class ArithExpr: public Expr {
 public:
-    MultExpr(std::unique_ptr<Expr> left,
-             std::unique_ptr<Expr> right):
-                left(std::move(left)), right(std::move(right)) {}
+    ArithExpr(std::unique_ptr<Expr> left,
+              std::unique_ptr<Expr> right, ArithOp op):
+                left(std::move(left)), right(std::move(right)), op(op) {}
 
     Datum *eval(const Tuple &tuple) override {
         auto leftResult = left->eval(tuple);
         auto rightResult = right->eval(tuple);
-        lastResult = move(leftResult->multiply(*rightResult));
+        leftResult->arithmeticTo(op, *rightResult, lastResult);
         return lastResult.get();
     }
 
-    static std::unique_ptr<MultExpr> make(std::unique_ptr<Expr> left,
-                                          std::unique_ptr<Expr> right) {
-        return std::make_unique<MultExpr>(std::move(left), std::move(right));
+    std::unique_ptr<Expr> simplify() override;
+
+    void visitChildren(const ExprVisitor &visit) override {
+        visit(left);
+        visit(right);
+    }
+
+    bool writeKey(std::string &out) const override {
+        out += 'a';
+        out += (char) op;
+        return left->writeKey(out) && right->writeKey(out);
+    }
+
+    static std::unique_ptr<ArithExpr> make(std::unique_ptr<Expr> left,
+                                           std::unique_ptr<Expr> right,
+                                           ArithOp op)
+    {
+        return std::make_unique<ArithExpr>(std::move(left), std::move(right), op);
     }
 private:
     std::unique_ptr<Expr> left, right;
+    ArithOp op;
     std::unique_ptr<Datum> lastResult;
 };
 
-enum CompareOp {
-    LT,
-    LTE,
-    EQ,
-    GTE,
-    GT
+class MultExpr: public ArithExpr {
+public:
+    MultExpr(std::unique_ptr<Expr> left,
+             std::unique_ptr<Expr> right):
+                ArithExpr(std::move(left), std::move(right), MULTIPLY) {}
+
+    static std::unique_ptr<MultExpr> make(std::unique_ptr<Expr> left,
+                                          std::unique_ptr<Expr> right) {
+        return std::make_unique<MultExpr>(std::move(left), std::move(right));
+    }
 };
 
 static std::unique_ptr<BoolDatum> True = std::make_unique<BoolDatum>(true);
 static std::unique_ptr<BoolDatum> False = std::make_unique<BoolDatum>(false);
 
+/* compares two datums, returning a negative number, 0 or a positive number */
+typedef int (*CompareKernel)(const Datum &a, const Datum &b);
+
+/* kernel for datums which are both BoxedDatum<T> or NULL, which sorts first */
+template <class T>
+int compareDatums(const Datum &a, const Datum &b) {
+    bool aNull = a.isNull(), bNull = b.isNull();
+    if (aNull || bNull)
+        return (int) bNull - (int) aNull;
+    const T &x = static_cast<const BoxedDatum<T> &>(a).value;
+    const T &y = static_cast<const BoxedDatum<T> &>(b).value;
+    return x < y ? -1 : (y < x ? 1 : 0);
+}
+
+/* the result of a comparison whose operands are in the given order */
+inline bool compareResult(CompareOp op, int order) {
+    switch (op) {
+        case LT:
+            return order < 0;
+        case LTE:
+            return order <= 0;
+        case EQ:
+            return order == 0;
+        case GTE:
+            return order >= 0;
+        case GT:
+            return order > 0;
+    }
+    return false;
+}
+
 class CompareExpr: public Expr {
 public:
     CompareExpr(std::unique_ptr<Expr> left,
                 std::unique_ptr<Expr> right, CompareOp op):
                     left(std::move(left)), right(std::move(right)), op(op) {}
 
+    /*
+     * Operands are compared by a kernel for their type, which is picked on
+     * the first row where neither is NULL. Values of a column all have the
+     * type of the column, so it stays the same for the other rows.
+     */
     virtual Datum *eval(const Tuple &tuple) override {
         auto lv = left->eval(tuple), rv = right->eval(tuple);
-        bool leftIsLess = *lv < *rv;
-        bool rightIsLess = *rv < *lv;
-        bool eq = !leftIsLess && !rightIsLess;
-        bool result = false;
-        switch (op) {
-            case LT:
-                result = leftIsLess;
-                break;
-            case LTE:
-                result = leftIsLess || eq;
-                break;
-            case EQ:
-                result = eq;
-                break;
-            case GTE: 
-                result = rightIsLess || eq;
-                break;
-            case GT:
-                result = rightIsLess;
-                break;
-        }
-        return result ? True.get() : False.get();
+        int order = kernel ? kernel(*lv, *rv) : bindKernel(*lv, *rv);
+        return compareResult(op, order) ? True.get() : False.get();
+    }
+
+    /* also turns comparisons of a column with a constant into a ColumnCompareExpr */
+    std::unique_ptr<Expr> simplify() override;
+
+    void visitChildren(const ExprVisitor &visit) override {
+        visit(left);
+        visit(right);
     }
 
+    bool writeKey(std::string &out) const override {
+        out += 'k';
+        out += (char) op;
+        return left->writeKey(out) && right->writeKey(out);
+    }
+
+    bool columnBound(int &column, CompareOp &op, const Datum *&value) const override;
+
     static std::unique_ptr<CompareExpr> make(std::unique_ptr<Expr> left,
                                              std::unique_ptr<Expr> right,
                                              CompareOp op)
@@ -121,20 +257,123 @@ public:
 private:
     std::unique_ptr<Expr> left, right;
     CompareOp op;
+    CompareKernel kernel = NULL;
+
+    int bindKernel(const Datum &left, const Datum &right);
 };
 
+/*
+ * column op constant, for a column of type T. The column value is compared
+ * with the constant as a T, without virtual calls, and batches are
+ * selected in a single loop. simplifyExpr() makes these of CompareExprs.
+ */
+template <class T, CompareOp Op>
+class ColumnCompareExpr: public Expr {
+public:
+    ColumnCompareExpr(int column, const Datum &constant):
+        column(column), constant(constant.clone()),
+        value(static_cast<const BoxedDatum<T> &>(constant).value) {}
+
+    Datum *eval(const Tuple &tuple) override {
+        return matches(*tuple[column]) ? True.get() : False.get();
+    }
+
+    size_t select(Tuple **rows, size_t n) override {
+        size_t selected = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (matches(*(*rows[i])[column]))
+                rows[selected++] = rows[i];
+        }
+        return selected;
+    }
+
+    /* the key of the CompareExpr this replaces */
+    bool writeKey(std::string &out) const override {
+        out += 'k';
+        out += (char) Op;
+        out += 'v';
+        writeValue(out, column);
+        out += 'c';
+        constant->write(out);
+        return true;
+    }
+
+    bool columnBound(int &column, CompareOp &op, const Datum *&value) const override {
+        column = this->column;
+        op = Op;
+        value = constant.get();
+        return true;
+    }
+private:
+    int column;
+    std::unique_ptr<Datum> constant;
+    T value;
+
+    bool matches(const Datum &datum) const {
+        /* NULL sorts before all values */
+        if (datum.isNull())
+            return Op == LT || Op == LTE;
+        const T &x = static_cast<const BoxedDatum<T> &>(datum).value;
+        switch (Op) {
+            case LT:
+                return x < value;
+            case LTE:
+                return !(value < x);
+            case EQ:
+                return !(x < value) && !(value < x);
+            case GTE:
+                return !(x < value);
+            case GT:
+                return value < x;
+        }
+        return false;
+    }
+};
+
+/*
+ * A ColumnCompareExpr for a constant of the given type, or NULL if there's
+ * none for its type.
+ */
+std::unique_ptr<Expr> makeColumnCompare(int column, CompareOp op, const Datum &constant);
+
 class AndExpr: public Expr {
 public:
     AndExpr(std::unique_ptr<Expr> left, std::unique_ptr<Expr> right):
         left(std::move(left)), right(std::move(right)) {}
 
+    /* right is only evaluated if left is true */
     Datum *eval(const Tuple &tuple) override {
-        auto lv = left->eval(tuple), rv = right->eval(tuple);
-        auto *leftBool = static_cast<const BoolDatum *>(lv);
-        auto *rightBool = static_cast<const BoolDatum *>(rv);
-        return (leftBool->value && rightBool->value) ? True.get() : False.get();
+        if (!static_cast<const BoolDatum *>(left->eval(tuple))->value)
+            return False.get();
+        return static_cast<const BoolDatum *>(right->eval(tuple))->value ? True.get() : False.get();
+    }
+
+    /* simplifies the conjuncts of a chain of ANDs together */
+    std::unique_ptr<Expr> simplify() override;
+
+    void visitChildren(const ExprVisitor &visit) override {
+        visit(left);
+        visit(right);
     }
 
+    bool writeKey(std::string &out) const override {
+        out += '&';
+        return left->writeKey(out) && right->writeKey(out);
+    }
+
+    /*
+     * Runs the conjuncts of the chain of ANDs one after another, each only
+     * on the rows the ones before kept. Every rankInterval batches they are
+     * put in the order of the time they took per row divided by the
+     * fraction of rows they dropped, so the cheapest and most selective
+     * ones run first. The statistics are halved at the same time, so recent
+     * batches weigh more, and dropped for conjuncts which saw no rows, so
+     * those are measured again.
+     */
+    size_t select(Tuple **rows, size_t n) override;
+
+    static constexpr size_t rankInterval = 16;
+
     static std::unique_ptr<AndExpr> make(std::unique_ptr<Expr> left,
                                          std::unique_ptr<Expr> right)
     {
@@ -142,7 +381,22 @@ public:
     }
 
 private:
+    struct Conjunct {
+        Expr *expr;
+        double rowsIn, rowsOut, nanoseconds;
+        /* rows seen since the last ranking */
+        size_t rowsSinceRank;
+    };
+
     std::unique_ptr<Expr> left, right;
+    /* the operands of the chain, in the order select() runs them */
+    std::vector<Conjunct> conjuncts;
+    size_t batches = 0;
+
+    void addConjuncts(Expr &expr);
+    void rankConjuncts();
+    static void takeConjuncts(std::unique_ptr<Expr> expr,
+                              std::vector<std::unique_ptr<Expr>> &conjuncts);
 };
 
 class OrExpr: public Expr {
@@ -150,11 +404,29 @@ public:
     OrExpr(std::unique_ptr<Expr> left, std::unique_ptr<Expr> right):
         left(std::move(left)), right(std::move(right)) {}
 
+    /* right is only evaluated if left is false */
     Datum *eval(const Tuple &tuple) override {
-        auto lv = left->eval(tuple), rv = right->eval(tuple);
-        auto *leftBool = static_cast<const BoolDatum *>(lv);
-        auto *rightBool = static_cast<const BoolDatum *>(rv);
-        return (leftBool->value || rightBool->value) ? True.get() : False.get();
+        if (static_cast<const BoolDatum *>(left->eval(tuple))->value)
+            return True.get();
+        return static_cast<const BoolDatum *>(right->eval(tuple))->value ? True.get() : False.get();
+    }
+
+    std::unique_ptr<Expr> simplify() override;
+
+    void visitChildren(const ExprVisitor &visit) override {
+        visit(left);
+        visit(right);
+    }
+
+    bool writeKey(std::string &out) const override {
+        out += '|';
+        return left->writeKey(out) && right->writeKey(out);
+    }
+
+    static std::unique_ptr<OrExpr> make(std::unique_ptr<Expr> left,
+                                        std::unique_ptr<Expr> right)
+    {
+        return std::make_unique<OrExpr>(std::move(left), std::move(right));
     }
 
 private:
@@ -171,8 +443,395 @@ public:
         return (!childBool->value) ? True.get() : False.get();
     }
 
+    std::unique_ptr<Expr> simplify() override;
+
+    void visitChildren(const ExprVisitor &visit) override { visit(child); }
+
+    bool writeKey(std::string &out) const override {
+        out += '!';
+        return child->writeKey(out);
+    }
+
+    static std::unique_ptr<NotExpr> make(std::unique_ptr<Expr> child) {
+        return std::make_unique<NotExpr>(std::move(child));
+    }
+
 private:
     std::unique_ptr<Expr> child;
 };
 
+/*
+ * column BETWEEN low AND high, where either bound may be exclusive, which
+ * simplifyExpr() makes of range pairs such as x >= a AND x < b. The column
+ * value is compared with the bounds as a T, instead of through two
+ * CompareExprs which each make two virtual comparisons. NULL is in no
+ * range, as it isn't for the pair it replaces.
+ */
+template <class T>
+class BetweenExpr: public Expr {
+public:
+    BetweenExpr(int column, T low, bool lowInclusive, T high, bool highInclusive):
+        column(column), low(std::move(low)), high(std::move(high)),
+        lowInclusive(lowInclusive), highInclusive(highInclusive) {}
+
+    Datum *eval(const Tuple &tuple) override {
+        const Datum &datum = *tuple[column];
+        if (datum.isNull())
+            return False.get();
+        const T &value = static_cast<const BoxedDatum<T> &>(datum).value;
+        bool aboveLow = lowInclusive ? !(value < low) : low < value;
+        bool belowHigh = highInclusive ? !(high < value) : value < high;
+        return (aboveLow && belowHigh) ? True.get() : False.get();
+    }
+
+    bool writeKey(std::string &out) const override {
+        out += 'b';
+        writeValue(out, column);
+        writeValue(out, low);
+        writeValue(out, high);
+        out += (char) (lowInclusive * 2 + highInclusive);
+        return true;
+    }
+private:
+    int column;
+    T low, high;
+    bool lowInclusive, highInclusive;
+};
+
+/*
+ * A BetweenExpr for bounds of the same type, or NULL if they differ, are
+ * NULL, or there is no BetweenExpr of their type.
+ */
+std::unique_ptr<Expr> makeBetween(int column, const Datum &low, bool lowInclusive,
+                                  const Datum &high, bool highInclusive);
+
+/*
+ * value IN (list), which is true if the value equals one of the values of
+ * the list. NULL equals nothing, so a NULL value is in no list, and NULLs
+ * in the list never match. simplifyExpr() turns tests of a column against
+ * a list of constants into a ColumnInExpr.
+ */
+class InExpr: public Expr {
+public:
+    InExpr(std::unique_ptr<Expr> value, std::vector<std::unique_ptr<Expr>> list):
+        value(std::move(value)), list(std::move(list)) {}
+
+    Datum *eval(const Tuple &tuple) override {
+        const Datum *v = value->eval(tuple);
+        if (v->isNull())
+            return False.get();
+        for (auto &item: list) {
+            const Datum *candidate = item->eval(tuple);
+            if (!candidate->isNull() && !(*v < *candidate) && !(*candidate < *v))
+                return True.get();
+        }
+        return False.get();
+    }
+
+    std::unique_ptr<Expr> simplify() override;
+
+    void visitChildren(const ExprVisitor &visit) override {
+        visit(value);
+        for (auto &item: list)
+            visit(item);
+    }
+
+    bool writeKey(std::string &out) const override {
+        out += 'i';
+        writeValue(out, list.size());
+        if (!value->writeKey(out))
+            return false;
+        for (auto &item: list) {
+            if (!item->writeKey(out))
+                return false;
+        }
+        return true;
+    }
+
+    static std::unique_ptr<InExpr> make(std::unique_ptr<Expr> value,
+                                        std::vector<std::unique_ptr<Expr>> list)
+    {
+        return std::make_unique<InExpr>(std::move(value), std::move(list));
+    }
+private:
+    std::unique_ptr<Expr> value;
+    std::vector<std::unique_ptr<Expr>> list;
+};
+
+/* how a ColumnInExpr looks up values in its list */
+enum InLookup {
+    IN_LINEAR,
+    IN_SORTED,
+    IN_BITMAP,
+    IN_PERFECT_HASH,
+    IN_HASH
+};
+
+/*
+ * column IN (values), for a column of type T. The lookup is picked by the
+ * size and type of the list:
+ *  - integers within a range of bitmapRange are looked up in a bitmap
+ *    indexed by the value minus the smallest one,
+ *  - lists of up to linearMax values are scanned,
+ *  - lists of up to perfectHashMax values get a perfect hash, a table with
+ *    at least as many slots as the square of their size and a seed for
+ *    which no two values hash to the same slot,
+ *  - lists of up to sortedMax values which aren't strings, which are cheap
+ *    to compare, are binary searched,
+ *  - the others are put in a hash set.
+ * Batches are selected by a loop for the lookup, without a switch per row.
+ */
+template <class T>
+class ColumnInExpr: public Expr {
+public:
+    static constexpr uint64_t bitmapRange = 1 << 16;
+    static constexpr size_t linearMax = 8;
+    static constexpr size_t perfectHashMax = 64;
+    static constexpr size_t sortedMax = 1024;
+    /* seeds tried before a list gets no perfect hash */
+    static constexpr uint64_t perfectHashSeeds = 32;
+
+    ColumnInExpr(int column, std::vector<T> list): column(column), values(std::move(list)) {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end(), Equal()), values.end());
+        if (buildBitmap())
+            lookup = IN_BITMAP;
+        else if (values.size() <= linearMax)
+            lookup = IN_LINEAR;
+        else if (values.size() <= perfectHashMax && buildPerfectHash())
+            lookup = IN_PERFECT_HASH;
+        else if (!std::is_same<T, std::string>::value && values.size() <= sortedMax)
+            lookup = IN_SORTED;
+        else {
+            set.insert(values.begin(), values.end());
+            lookup = IN_HASH;
+        }
+    }
+
+    Datum *eval(const Tuple &tuple) override {
+        const Datum &datum = *tuple[column];
+        if (datum.isNull())
+            return False.get();
+        const T &x = static_cast<const BoxedDatum<T> &>(datum).value;
+        bool found;
+        switch (lookup) {
+            case IN_BITMAP:
+                found = bitmapContains(x);
+                break;
+            case IN_LINEAR:
+                found = linearContains(x);
+                break;
+            case IN_PERFECT_HASH:
+                found = perfectHashContains(x);
+                break;
+            case IN_SORTED:
+                found = sortedContains(x);
+                break;
+            default:
+                found = hashContains(x);
+        }
+        return found ? True.get() : False.get();
+    }
+
+    size_t select(Tuple **rows, size_t n) override {
+        switch (lookup) {
+            case IN_BITMAP:
+                return selectWith(rows, n, [this](const T &x) { return bitmapContains(x); });
+            case IN_LINEAR:
+                return selectWith(rows, n, [this](const T &x) { return linearContains(x); });
+            case IN_PERFECT_HASH:
+                return selectWith(rows, n, [this](const T &x) { return perfectHashContains(x); });
+            case IN_SORTED:
+                return selectWith(rows, n, [this](const T &x) { return sortedContains(x); });
+            default:
+                return selectWith(rows, n, [this](const T &x) { return hashContains(x); });
+        }
+    }
+
+    bool writeKey(std::string &out) const override {
+        out += 'n';
+        writeValue(out, column);
+        writeValue(out, values.size());
+        for (const T &value: values)
+            writeValue(out, value);
+        return true;
+    }
+
+    InLookup getLookup() const { return lookup; }
+private:
+    struct Equal {
+        bool operator()(const T &a, const T &b) const { return !(a < b) && !(b < a); }
+    };
+
+    int column;
+    InLookup lookup;
+    /* the distinct values of the list, sorted */
+    std::vector<T> values;
+    /* bit i is set if bitmapMin + i is in the list */
+    std::vector<uint64_t> bitmap;
+    long long bitmapMin = 0;
+    /* 1 + the index in values of the value hashed to each slot, or 0 */
+    std::vector<uint8_t> slots;
+    uint64_t seed = 0;
+    int shift = 0;
+    std::unordered_set<T, std::hash<T>, Equal> set;
+
+    bool buildBitmap() {
+        if constexpr (std::is_integral<T>::value) {
+            if (values.empty())
+                return false;
+            if ((uint64_t) values.back() - (uint64_t) values.front() >= bitmapRange)
+                return false;
+            bitmapMin = values.front();
+            bitmap.assign(((uint64_t) values.back() - (uint64_t) bitmapMin) / 64 + 1, 0);
+            for (const T &value: values) {
+                uint64_t offset = (uint64_t) value - (uint64_t) bitmapMin;
+                bitmap[offset / 64] |= (uint64_t) 1 << (offset % 64);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool buildPerfectHash() {
+        int bits = 1;
+        while (((size_t) 1 << bits) < values.size() * values.size())
+            bits++;
+        shift = 64 - bits;
+        /* at least half of all seeds are collision free with that many slots */
+        for (seed = 0; seed < perfectHashSeeds; seed++) {
+            slots.assign((size_t) 1 << bits, 0);
+            size_t i = 0;
+            for (; i < values.size() && !slots[slotOf(values[i])]; i++)
+                slots[slotOf(values[i])] = i + 1;
+            if (i == values.size())
+                return true;
+        }
+        slots.clear();
+        return false;
+    }
+
+    size_t slotOf(const T &x) const {
+        return mixHash(std::hash<T>()(x) ^ seed) >> shift;
+    }
+
+    bool bitmapContains(const T &x) const {
+        if constexpr (std::is_integral<T>::value) {
+            uint64_t offset = (uint64_t) x - (uint64_t) bitmapMin;
+            return offset < bitmap.size() * 64 && (bitmap[offset / 64] >> (offset % 64) & 1);
+        }
+        return false;
+    }
+
+    bool linearContains(const T &x) const {
+        for (const T &value: values) {
+            if (Equal()(value, x))
+                return true;
+        }
+        return false;
+    }
+
+    bool perfectHashContains(const T &x) const {
+        uint8_t slot = slots[slotOf(x)];
+        return slot && Equal()(values[slot - 1], x);
+    }
+
+    bool sortedContains(const T &x) const {
+        return std::binary_search(values.begin(), values.end(), x);
+    }
+
+    bool hashContains(const T &x) const {
+        return set.count(x);
+    }
+
+    template <class Contains>
+    size_t selectWith(Tuple **rows, size_t n, Contains contains) const {
+        size_t selected = 0;
+        for (size_t i = 0; i < n; i++) {
+            const Datum &datum = *(*rows[i])[column];
+            if (!datum.isNull() && contains(static_cast<const BoxedDatum<T> &>(datum).value))
+                rows[selected++] = rows[i];
+        }
+        return selected;
+    }
+};
+
+/*
+ * A ColumnInExpr for non-NULL constants of the same type, or NULL if their
+ * types differ or there is no ColumnInExpr of their type.
+ */
+std::unique_ptr<Expr> makeColumnIn(int column, const std::vector<const Datum *> &values);
+
+/*
+ * Subexpressions which several expressions evaluated on the same rows have
+ * in common, each of which is evaluated only once per row. Results are
+ * kept for all rows of the current batch, in an open addressing table per
+ * subexpression on the address of the row, so they are found again both
+ * when each row goes through all expressions in turn, and when each
+ * expression goes through the whole batch. Results are dropped by
+ * nextRows(), which the first node to evaluate the expressions calls
+ * whenever it reads rows which may have replaced those seen before.
+ */
+class CommonExprs {
+public:
+    /* adds a subexpression, and returns its slot */
+    size_t add(std::unique_ptr<Expr> expr);
+    std::unique_ptr<Expr> &getExpr(size_t slot) { return slots[slot]->expr; }
+    size_t size() const { return slots.size(); }
+
+    /* the result of the subexpression in slot for tuple, valid until nextRows() */
+    Datum *eval(size_t slot, const Tuple &tuple);
+
+    void nextRows() { generation++; }
+
+    /* four times ExecNode::batchSize entries per subexpression */
+    static constexpr int tableBits = 12;
+    /* entries looked at before a result isn't kept */
+    static constexpr size_t maxProbes = 16;
+private:
+    /* entries of earlier generations are free */
+    struct Entry {
+        const Tuple *row = NULL;
+        uint64_t generation = 0;
+        DatumP value;
+    };
+
+    struct Slot {
+        std::unique_ptr<Expr> expr;
+        std::vector<Entry> entries;
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    uint64_t generation = 1;
+};
+
+/* a subexpression of a CommonExprs, which takes its place in the expressions sharing it */
+class SharedExpr: public Expr {
+public:
+    SharedExpr(std::shared_ptr<CommonExprs> common, size_t slot):
+        common(std::move(common)), slot(slot) {}
+
+    Datum *eval(const Tuple &tuple) override {
+        return common->eval(slot, tuple);
+    }
+
+    bool writeKey(std::string &out) const override {
+        out += 's';
+        writeValue(out, (uintptr_t) common.get());
+        writeValue(out, slot);
+        return true;
+    }
+private:
+    std::shared_ptr<CommonExprs> common;
+    size_t slot;
+};
+
+/*
+ * Optimizer pass which finds subexpressions that occur more than once in
+ * exprs, which must all be evaluated on the same rows, and replaces them
+ * with SharedExprs, the largest first. Returns the CommonExprs they share,
+ * or NULL if there were none.
+ */
+std::shared_ptr<CommonExprs> shareCommonExprs(const std::vector<std::unique_ptr<Expr> *> &exprs);
+
 #endif
@@ -0,0 +1,713 @@
+#include <join.h>
+#include <sort.h>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+static void checkBuildWidth(JoinType type, size_t buildWidth);
+static bool evalJoinKey(vector<unique_ptr<Expr>> &exprs, const Tuple &tuple,
+                        vector<Datum *> &key, size_t &hash);
+static Tuple *joinTuples(Tuple &result, const Tuple &probeRow,
+                         const Tuple *buildRow, size_t buildWidth);
+static TupleP takeOutput(Tuple *output, Tuple &result);
+static Tuple *finishProbeRow(JoinType type, Tuple &result, Tuple *probeRow,
+                             bool matched, bool keyNull, size_t buildRows,
+                             bool buildHasNullKeys, size_t buildWidth);
+static void normalizeJoinKey(const vector<Datum *> &key, string &out);
+static unique_ptr<ExecNode> sortedOnKeys(unique_ptr<ExecNode> node,
+                                         vector<unique_ptr<Expr>> &keys);
+static void partitionPass(const size_t *hashes, const uint32_t *in, uint32_t *out,
+                          size_t n, int shift, int bits, size_t *bounds);
+static void visitJoinExprs(ExecNode &probe, ExecNode &build,
+                           vector<unique_ptr<Expr>> &probeKeys,
+                           vector<unique_ptr<Expr>> &buildKeys, const ExprVisitor &visit);
+static shared_ptr<JoinKeyFilter> pushKeyFilter(ExecNode &probe,
+                                               vector<unique_ptr<Expr>> &probeKeys,
+                                               JoinType type);
+
+/* JoinHashTable */
+void JoinHashTable::add(TupleP row, Datum *const *key, size_t hash) {
+    rows.push_back(move(row));
+    hashes.push_back(hash);
+    for (size_t i = 0; i < keyCount; i++)
+        keys.push_back(key[i]->clone());
+}
+
+void JoinHashTable::finalize() {
+    size_t bucketCount = 1;
+    while (bucketCount < 2 * rows.size())
+        bucketCount *= 2;
+    bucketMask = bucketCount - 1;
+    buckets.assign(bucketCount, END);
+    nextRow.resize(rows.size());
+    for (uint32_t i = 0; i < rows.size(); i++) {
+        uint64_t &bucket = buckets[hashes[i] & bucketMask];
+        nextRow[i] = (uint32_t) bucket;
+        bucket = (bucket & ~0xffffffffULL) | tagOf(hashes[i]) | i;
+    }
+}
+
+bool JoinHashTable::matches(uint32_t row, Datum *const *key, size_t hash) const {
+    if (hashes[row] != hash)
+        return false;
+    const DatumP *rowKey = &keys[row * keyCount];
+    for (size_t i = 0; i < keyCount; i++) {
+        if (*rowKey[i] != *key[i])
+            return false;
+    }
+    return true;
+}
+
+/* JoinKeyFilter */
+bool JoinKeyFilter::pass(const Tuple &tuple) {
+    if (!published)
+        return true;
+    size_t hash;
+    bool keep = !minKey.empty() && evalJoinKey(probeKeys, tuple, key, hash) &&
+                bloom.mayContain(hash);
+    for (size_t i = 0; keep && i < key.size(); i++)
+        keep = !(*key[i] < *minKey[i]) && !(*maxKey[i] < *key[i]);
+    if (!keep)
+        dropped++;
+    return keep;
+}
+
+void JoinKeyFilter::publish(const vector<size_t> &hashes, const vector<DatumP> &keys) {
+    bloom = BloomFilter(hashes.size());
+    for (size_t hash: hashes)
+        bloom.add(hash);
+    minKey.clear();
+    maxKey.clear();
+    size_t keyCount = probeKeys.size();
+    for (size_t i = 0; i < keys.size(); i++) {
+        size_t column = i % keyCount;
+        if (i < keyCount) {
+            minKey.push_back(keys[i]->clone());
+            maxKey.push_back(keys[i]->clone());
+        } else if (*keys[i] < *minKey[column]) {
+            minKey[column] = keys[i]->clone();
+        } else if (*maxKey[column] < *keys[i]) {
+            maxKey[column] = keys[i]->clone();
+        }
+    }
+    published = true;
+}
+
+/* ExecHashJoin */
+ExecHashJoin::ExecHashJoin(unique_ptr<ExecNode> probe, unique_ptr<ExecNode> build,
+                           vector<unique_ptr<Expr>> probeKeys,
+                           vector<unique_ptr<Expr>> buildKeys,
+                           JoinType type, size_t buildWidth, ProbeMode probeMode):
+    probe(move(probe)), build(move(build)),
+    probeKeys(move(probeKeys)), buildKeys(move(buildKeys)),
+    type(type), buildWidth(buildWidth), probeMode(probeMode),
+    table(this->buildKeys.size())
+{
+    checkBuildWidth(type, buildWidth);
+    keyFilter = pushKeyFilter(*this->probe, this->probeKeys, type);
+}
+
+Tuple* ExecHashJoin::nextTuple() {
+    if (!built)
+        buildTable();
+    while (true) {
+        if (!probeTuple) {
+            if (!nextProbeRow())
+                return NULL;
+            probeMatched = false;
+        }
+
+        /* walk the chain of the probe row's bucket */
+        while (candidate != JoinHashTable::END) {
+            uint32_t row = candidate;
+            candidate = table.next(candidate);
+            if (!table.matches(row, probeKey.data(), probeHash))
+                continue;
+            probeMatched = true;
+            if (type == JOIN_INNER || type == JOIN_LEFT)
+                return joinTuples(result, *probeTuple, &table.row(row), buildWidth);
+            candidate = JoinHashTable::END;
+        }
+
+        /* chain is done, so finish this probe row */
+        Tuple *current = probeTuple;
+        probeTuple = NULL;
+        Tuple *output = finishProbeRow(type, result, current, probeMatched, probeKeyNull,
+                                       buildRows, buildHasNullKeys, buildWidth);
+        if (output)
+            return output;
+    }
+}
+
+TupleP ExecHashJoin::takeTuple() {
+    return takeOutput(nextTuple(), result);
+}
+
+void ExecHashJoin::buildTable() {
+    vector<Datum *> key;
+    size_t hash;
+    TupleP tuple;
+    while ((tuple = build->takeTuple())) {
+        buildRows++;
+        if (evalJoinKey(buildKeys, *tuple, key, hash))
+            table.add(move(tuple), key.data(), hash);
+        else
+            buildHasNullKeys = true;
+    }
+    finish();
+}
+
+void ExecHashJoin::visitExprs(const ExprVisitor &visit) {
+    visitJoinExprs(*probe, *build, probeKeys, buildKeys, visit);
+}
+
+void ExecHashJoin::addPipelines(PipelineExecutor &executor) {
+    probe->addPipelines(executor);
+    executor.addPipeline(*build, *this);
+}
+
+/* pushed build rows are borrowed, so only those which go into the table are copied */
+void ExecHashJoin::consume(Tuple *const *rows, size_t n) {
+    vector<Datum *> key;
+    size_t hash;
+    for (size_t i = 0; i < n; i++) {
+        buildRows++;
+        if (evalJoinKey(buildKeys, *rows[i], key, hash))
+            table.add(cloneTuple(*rows[i]), key.data(), hash);
+        else
+            buildHasNullKeys = true;
+    }
+}
+
+void ExecHashJoin::finish() {
+    table.finalize();
+    if (keyFilter)
+        keyFilter->publish(table.getHashes(), table.getKeys());
+    interleaved = (probeMode == PROBE_INTERLEAVED ||
+                   (probeMode == PROBE_AUTO && table.size() >= interleaveRows));
+    built = true;
+}
+
+/*
+ * Takes the next probe row, and sets up the walk of its bucket's chain.
+ * Returns false once the probe input is exhausted.
+ */
+bool ExecHashJoin::nextProbeRow() {
+    if (!interleaved) {
+        probeTuple = probe->nextTuple();
+        if (!probeTuple)
+            return false;
+        candidate = JoinHashTable::END;
+        probeKeyNull = !evalJoinKey(probeKeys, *probeTuple, probeKey, probeHash);
+        if (!probeKeyNull)
+            candidate = table.first(probeHash);
+        return true;
+    }
+
+    if (batchPos == probeBatch.size()) {
+        size_t n = probe->nextBatch(probeBatch);
+        if (n == 0)
+            return false;
+        batchHashes.resize(n);
+        batchCandidates.resize(n);
+        batchKeyNull.resize(n);
+        batchPos = stagedEnd = 0;
+    }
+    if (batchPos == stagedEnd)
+        stageProbeGroup();
+    size_t i = batchPos++;
+    probeTuple = probeBatch[i];
+    probeHash = batchHashes[i];
+    probeKeyNull = batchKeyNull[i];
+    candidate = batchCandidates[i];
+    if (candidate != JoinHashTable::END) {
+        size_t keyCount = probeKeys.size();
+        DatumP *staged = &stagedKeys[i % probeGroupSize * keyCount];
+        probeKey.resize(keyCount);
+        for (size_t k = 0; k < keyCount; k++)
+            probeKey[k] = staged[k].get();
+    }
+    return true;
+}
+
+/* hashes the next group of the probe batch and looks up its buckets, one stage at a time */
+void ExecHashJoin::stageProbeGroup() {
+    size_t end = min(stagedEnd + probeGroupSize, probeBatch.size());
+    size_t keyCount = probeKeys.size();
+    stagedKeys.resize(probeGroupSize * keyCount);
+    for (size_t i = stagedEnd; i < end; i++) {
+        batchKeyNull[i] = !evalJoinKey(probeKeys, *probeBatch[i], probeKey, batchHashes[i]);
+        if (batchKeyNull[i])
+            continue;
+        table.prefetchBucket(batchHashes[i]);
+        DatumP *staged = &stagedKeys[i % probeGroupSize * keyCount];
+        for (size_t k = 0; k < keyCount; k++)
+            probeKey[k]->copyTo(staged[k]);
+    }
+    for (size_t i = stagedEnd; i < end; i++) {
+        batchCandidates[i] = JoinHashTable::END;
+        if (!batchKeyNull[i])
+            batchCandidates[i] = table.first(batchHashes[i]);
+        if (batchCandidates[i] != JoinHashTable::END)
+            table.prefetchRow(batchCandidates[i]);
+    }
+    stagedEnd = end;
+}
+
+/* ExecRadixJoin */
+ExecRadixJoin::ExecRadixJoin(unique_ptr<ExecNode> probe, unique_ptr<ExecNode> build,
+                             vector<unique_ptr<Expr>> probeKeys,
+                             vector<unique_ptr<Expr>> buildKeys,
+                             JoinType type, size_t buildWidth,
+                             size_t threads, int radixBits):
+    probe(move(probe)), build(move(build)),
+    probeKeys(move(probeKeys)), buildKeys(move(buildKeys)),
+    type(type), buildWidth(buildWidth), threads(threads), radixBits(radixBits)
+{
+    checkBuildWidth(type, buildWidth);
+    keyFilter = pushKeyFilter(*this->probe, this->probeKeys, type);
+}
+
+void ExecRadixJoin::visitExprs(const ExprVisitor &visit) {
+    visitJoinExprs(*probe, *build, probeKeys, buildKeys, visit);
+}
+
+Tuple* ExecRadixJoin::nextTuple() {
+    if (!joined)
+        join();
+    for (; nextPartition < matches.size(); nextPartition++, nextMatch = 0) {
+        auto &partitionMatches = matches[nextPartition];
+        if (nextMatch < partitionMatches.size()) {
+            auto match = partitionMatches[nextMatch++];
+            Tuple *probeRow = probeSide.rows[match.first].get();
+            bool matched = (match.second != JoinHashTable::END);
+            if (type == JOIN_INNER || (type == JOIN_LEFT && matched))
+                return joinTuples(result, *probeRow, buildSide.rows[match.second].get(),
+                                  buildWidth);
+            return finishProbeRow(type, result, probeRow, matched, false,
+                                  buildRows, buildHasNullKeys, buildWidth);
+        }
+    }
+    if (nextNullKeyRow < nullKeyRows.size()) {
+        Tuple *probeRow = probeSide.rows[nullKeyRows[nextNullKeyRow++]].get();
+        return finishProbeRow(type, result, probeRow, false, true,
+                              buildRows, buildHasNullKeys, buildWidth);
+    }
+    return NULL;
+}
+
+void ExecRadixJoin::join() {
+    readSide(*build, buildKeys, buildSide, false);
+    if (keyFilter)
+        keyFilter->publish(buildSide.hashes, buildSide.keys);
+    readSide(*probe, probeKeys, probeSide, true);
+
+    int bits = radixBits;
+    if (bits < 0) {
+        bits = 0;
+        while (bits < 2 * maxPassBits &&
+               (buildSide.rows.size() >> bits) > partitionRows)
+            bits++;
+    }
+    partition(buildSide, bits);
+    partition(probeSide, bits);
+
+    /* workers take partitions one at a time, until none is left */
+    size_t partitions = buildSide.bounds.size() - 1;
+    matches.resize(partitions);
+    size_t threadCount = threads ? threads : max(thread::hardware_concurrency(), 1u);
+    threadCount = min(threadCount, partitions);
+    atomic<size_t> nextJob(0);
+    auto worker = [this, &nextJob, partitions]() {
+        size_t p;
+        while ((p = nextJob++) < partitions)
+            joinPartition(p);
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < threadCount; i++)
+        workers.emplace_back(worker);
+    worker();
+    for (thread &t: workers)
+        t.join();
+    joined = true;
+}
+
+TupleP ExecRadixJoin::takeTuple() {
+    return takeOutput(nextTuple(), result);
+}
+
+void ExecRadixJoin::readSide(ExecNode &node, vector<unique_ptr<Expr>> &exprs,
+                             Side &side, bool isProbe)
+{
+    vector<Datum *> key;
+    size_t hash;
+    TupleP tuple;
+    while ((tuple = node.takeTuple())) {
+        uint32_t row = side.rows.size();
+        if (!isProbe)
+            buildRows++;
+        if (!evalJoinKey(exprs, *tuple, key, hash)) {
+            if (!isProbe)
+                buildHasNullKeys = true;
+            if (!isProbe || type == JOIN_INNER || type == JOIN_SEMI)
+                continue;
+            /* keep hashes and keys indexed by row number */
+            nullKeyRows.push_back(row);
+            side.hashes.push_back(0);
+            for (size_t i = 0; i < exprs.size(); i++)
+                side.keys.push_back(make_unique<NullDatum>());
+        } else {
+            side.order.push_back(row);
+            side.hashes.push_back(hash);
+            for (Datum *value: key)
+                side.keys.push_back(value->clone());
+        }
+        side.rows.push_back(move(tuple));
+    }
+}
+
+/*
+ * Orders the side's rows by the partition number, which is taken from bits
+ * 32 and up of the hash, so that it's independent of the bucket numbers
+ * used in joinPartition().
+ */
+void ExecRadixJoin::partition(Side &side, int bits) {
+    size_t n = side.order.size();
+    int firstBits = min(bits, maxPassBits);
+    int secondBits = bits - firstBits;
+    vector<size_t> firstBounds((1 << firstBits) + 1);
+    vector<uint32_t> firstOrder(n);
+    partitionPass(side.hashes.data(), side.order.data(), firstOrder.data(), n,
+                  32 + secondBits, firstBits, firstBounds.data());
+
+    side.bounds.assign((1 << bits) + 1, n);
+    if (secondBits == 0) {
+        side.order = move(firstOrder);
+        copy(firstBounds.begin(), firstBounds.end(), side.bounds.begin());
+        return;
+    }
+    /* split each partition of the first pass into 2^secondBits partitions */
+    for (size_t p = 0; p + 1 < firstBounds.size(); p++) {
+        size_t start = firstBounds[p];
+        size_t *bounds = &side.bounds[p << secondBits];
+        partitionPass(side.hashes.data(), firstOrder.data() + start,
+                      side.order.data() + start, firstBounds[p + 1] - start,
+                      32, secondBits, bounds);
+        for (size_t i = 0; i <= (1u << secondBits); i++)
+            bounds[i] += start;
+    }
+}
+
+/* joins a pair of partitions, called by worker threads */
+void ExecRadixJoin::joinPartition(size_t p) {
+    const uint32_t *buildRows = buildSide.order.data() + buildSide.bounds[p];
+    size_t buildCount = buildSide.bounds[p + 1] - buildSide.bounds[p];
+    const uint32_t *probeRows = probeSide.order.data() + probeSide.bounds[p];
+    size_t probeCount = probeSide.bounds[p + 1] - probeSide.bounds[p];
+    size_t keyCount = buildKeys.size();
+
+    /* chained table over the partition's build rows */
+    size_t bucketCount = 1;
+    while (bucketCount < 2 * buildCount)
+        bucketCount *= 2;
+    size_t mask = bucketCount - 1;
+    vector<uint32_t> heads(bucketCount, JoinHashTable::END);
+    vector<uint32_t> next(buildCount);
+    for (uint32_t i = 0; i < buildCount; i++) {
+        uint32_t &head = heads[buildSide.hashes[buildRows[i]] & mask];
+        next[i] = head;
+        head = i;
+    }
+
+    auto &out = matches[p];
+    for (size_t i = 0; i < probeCount; i++) {
+        uint32_t probeRow = probeRows[i];
+        size_t hash = probeSide.hashes[probeRow];
+        const DatumP *probeKey = &probeSide.keys[probeRow * keyCount];
+        bool matched = false;
+        for (uint32_t j = heads[hash & mask]; j != JoinHashTable::END; j = next[j]) {
+            uint32_t buildRow = buildRows[j];
+            if (buildSide.hashes[buildRow] != hash)
+                continue;
+            const DatumP *buildKey = &buildSide.keys[buildRow * keyCount];
+            bool equal = true;
+            for (size_t k = 0; k < keyCount && equal; k++)
+                equal = (*probeKey[k] == *buildKey[k]);
+            if (!equal)
+                continue;
+            matched = true;
+            if (type == JOIN_INNER || type == JOIN_LEFT || type == JOIN_SEMI)
+                out.push_back(make_pair(probeRow, buildRow));
+            else if (type == JOIN_MARK)
+                out.push_back(make_pair(probeRow, MATCHED));
+            if (type != JOIN_INNER && type != JOIN_LEFT)
+                break;
+        }
+        if (!matched && type != JOIN_INNER && type != JOIN_SEMI)
+            out.push_back(make_pair(probeRow, JoinHashTable::END));
+    }
+}
+
+/* ExecMergeJoin */
+ExecMergeJoin::ExecMergeJoin(unique_ptr<ExecNode> probe, unique_ptr<ExecNode> build,
+                             vector<unique_ptr<Expr>> probeKeys,
+                             vector<unique_ptr<Expr>> buildKeys,
+                             JoinType type, size_t buildWidth, bool sortInputs):
+    probeKeys(move(probeKeys)), buildKeys(move(buildKeys)),
+    type(type), buildWidth(buildWidth)
+{
+    if (type == JOIN_MARK)
+        throw invalid_argument("ExecMergeJoin doesn't support JOIN_MARK");
+    checkBuildWidth(type, buildWidth);
+    if (sortInputs) {
+        probe = sortedOnKeys(move(probe), this->probeKeys);
+        build = sortedOnKeys(move(build), this->buildKeys);
+    }
+    this->probe = move(probe);
+    this->build = move(build);
+}
+
+void ExecMergeJoin::visitExprs(const ExprVisitor &visit) {
+    visitJoinExprs(*probe, *build, probeKeys, buildKeys, visit);
+}
+
+Tuple* ExecMergeJoin::nextTuple() {
+    if (!buildStarted) {
+        readBuildRow();
+        buildStarted = true;
+    }
+    while (true) {
+        if (probeTuple && nextGroupRow < group.size())
+            return joinTuples(result, *probeTuple, group[nextGroupRow++].get(), buildWidth);
+
+        probeTuple = probe->nextTuple();
+        if (!probeTuple)
+            return NULL;
+        size_t hash;
+        bool matched = false;
+        if (evalJoinKey(probeKeys, *probeTuple, probeKey, hash)) {
+            normalizeJoinKey(probeKey, probeNormKey);
+            matched = advanceBuild(probeNormKey);
+        }
+        if (matched && (type == JOIN_INNER || type == JOIN_LEFT)) {
+            nextGroupRow = 0;
+            continue;
+        }
+        nextGroupRow = group.size();
+        Tuple *output = finishProbeRow(type, result, probeTuple, matched, false,
+                                       0, false, buildWidth);
+        if (output)
+            return output;
+    }
+}
+
+TupleP ExecMergeJoin::takeTuple() {
+    return takeOutput(nextTuple(), result);
+}
+
+/* reads the next build row with a non-NULL key into buildNext */
+void ExecMergeJoin::readBuildRow() {
+    vector<Datum *> key;
+    size_t hash;
+    TupleP tuple;
+    buildNext.reset();
+    while ((tuple = build->takeTuple())) {
+        if (!evalJoinKey(buildKeys, *tuple, key, hash))
+            continue;
+        buildNext = move(tuple);
+        normalizeJoinKey(key, buildNextKey);
+        return;
+    }
+}
+
+/*
+ * Makes the build rows with the given key the current group, skipping
+ * smaller build keys. Returns false if there are no such rows. Probe keys
+ * never decrease, so the current group is kept while keys repeat.
+ */
+bool ExecMergeJoin::advanceBuild(const string &key) {
+    if (!group.empty()) {
+        int cmp = key.compare(groupKey);
+        if (cmp == 0)
+            return true;
+        if (cmp < 0)
+            return false;
+    }
+    while (buildNext && key > buildNextKey)
+        readBuildRow();
+    if (!buildNext || key < buildNextKey)
+        return false;
+
+    group.clear();
+    groupKey = buildNextKey;
+    group.push_back(move(buildNext));
+    readBuildRow();
+    while (buildNext && key == buildNextKey) {
+        group.push_back(move(buildNext));
+        readBuildRow();
+    }
+    return true;
+}
+
+/* unmatched rows of a left join are padded with buildWidth NULLs */
+static void checkBuildWidth(JoinType type, size_t buildWidth) {
+    if (type == JOIN_LEFT && buildWidth == 0)
+        throw invalid_argument("JOIN_LEFT needs the number of build columns");
+}
+
+/*
+ * Evaluates the key expressions on the tuple. Returns false if any of the
+ * key values is NULL, since such rows can't match anything.
+ */
+static bool evalJoinKey(vector<unique_ptr<Expr>> &exprs, const Tuple &tuple,
+                        vector<Datum *> &key, size_t &hash)
+{
+    key.clear();
+    hash = 0;
+    for (const auto &expr: exprs) {
+        Datum *value = expr->eval(tuple);
+        if (value->isNull())
+            return false;
+        key.push_back(value);
+        hash = hashCombine(hash, *value);
+    }
+    return true;
+}
+
+/* probe columns followed by the build columns, or NULLs if there's no match */
+static Tuple *joinTuples(Tuple &result, const Tuple &probeRow,
+                         const Tuple *buildRow, size_t buildWidth)
+{
+    result.clear();
+    for (const DatumP &datum: probeRow)
+        result.push_back(datum->clone());
+    if (buildRow) {
+        for (const DatumP &datum: *buildRow)
+            result.push_back(datum->clone());
+    } else {
+        for (size_t i = 0; i < buildWidth; i++)
+            result.push_back(make_unique<NullDatum>());
+    }
+    return &result;
+}
+
+/*
+ * Hands over an output tuple of a join. Joined rows are built in result,
+ * so they are moved out. Probe rows returned as they are belong to the
+ * probe side, so they are copied.
+ */
+static TupleP takeOutput(Tuple *output, Tuple &result) {
+    if (!output)
+        return NULL;
+    if (output == &result)
+        return make_unique<Tuple>(move(result));
+    return cloneTuple(*output);
+}
+
+/*
+ * Output for a probe row once it's known whether it has a match, for join
+ * types which return probe rows without their matches. Returns NULL if the
+ * row isn't part of the result.
+ */
+static Tuple *finishProbeRow(JoinType type, Tuple &result, Tuple *probeRow,
+                             bool matched, bool keyNull, size_t buildRows,
+                             bool buildHasNullKeys, size_t buildWidth)
+{
+    switch (type) {
+        case JOIN_INNER:
+            return NULL;
+        case JOIN_LEFT:
+            return matched ? NULL : joinTuples(result, *probeRow, NULL, buildWidth);
+        case JOIN_SEMI:
+            return matched ? probeRow : NULL;
+        case JOIN_ANTI:
+            return matched ? NULL : probeRow;
+        case JOIN_MARK:
+            break;
+    }
+    result.clear();
+    for (const DatumP &datum: *probeRow)
+        result.push_back(datum->clone());
+    if (matched)
+        result.push_back(make_unique<BoolDatum>(true));
+    else if (buildRows > 0 && (keyNull || buildHasNullKeys))
+        result.push_back(make_unique<NullDatum>());
+    else
+        result.push_back(make_unique<BoolDatum>(false));
+    return &result;
+}
+
+static void normalizeJoinKey(const vector<Datum *> &key, string &out) {
+    out.clear();
+    for (Datum *value: key)
+        normalizeDatum(out, *value);
+}
+
+/*
+ * An ExecSort which returns the rows of node ordered on the given keys,
+ * which stay owned by the join. It reads node when it's first read itself.
+ */
+static unique_ptr<ExecNode> sortedOnKeys(unique_ptr<ExecNode> node,
+                                         vector<unique_ptr<Expr>> &keys)
+{
+    vector<SortKey> sortKeys;
+    for (auto &key: keys)
+        sortKeys.push_back({ make_unique<JoinKeyRef>(key), false });
+    return make_unique<ExecSort>(move(node), move(sortKeys));
+}
+
+/*
+ * Scatters row numbers in to out by the given bits of their hashes, and
+ * sets bounds[p] to the start of partition p in out, with bounds[2^bits]
+ * set to n.
+ */
+static void partitionPass(const size_t *hashes, const uint32_t *in, uint32_t *out,
+                          size_t n, int shift, int bits, size_t *bounds)
+{
+    size_t partitions = (size_t) 1 << bits;
+    size_t mask = partitions - 1;
+    vector<size_t> offsets(partitions, 0);
+    for (size_t i = 0; i < n; i++)
+        offsets[(hashes[in[i]] >> shift) & mask]++;
+    size_t start = 0;
+    for (size_t p = 0; p < partitions; p++) {
+        bounds[p] = start;
+        start += offsets[p];
+        offsets[p] = bounds[p];
+    }
+    bounds[partitions] = n;
+    for (size_t i = 0; i < n; i++)
+        out[offsets[(hashes[in[i]] >> shift) & mask]++] = in[i];
+}
+
+static void visitJoinExprs(ExecNode &probe, ExecNode &build,
+                           vector<unique_ptr<Expr>> &probeKeys,
+                           vector<unique_ptr<Expr>> &buildKeys, const ExprVisitor &visit)
+{
+    probe.visitExprs(visit);
+    build.visitExprs(visit);
+    for (auto &key: probeKeys)
+        visit(key);
+    for (auto &key: buildKeys)
+        visit(key);
+}
+
+/*
+ * Pushes a key filter into the probe child of a join. Only inner and semi
+ * joins can drop probe rows without a match.
+ */
+static shared_ptr<JoinKeyFilter> pushKeyFilter(ExecNode &probe,
+                                               vector<unique_ptr<Expr>> &probeKeys,
+                                               JoinType type)
+{
+    if (type != JOIN_INNER && type != JOIN_SEMI)
+        return NULL;
+    auto filter = make_shared<JoinKeyFilter>(probeKeys);
+    if (!probe.addRowFilter(filter))
+        return NULL;
+    return filter;
+}
@@ -0,0 +1,384 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include <tuple.h>
+#include <expr.h>
+#include <rowstore.h>
+#include <bloom.h>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+enum JoinType {
+    /* probe row joined with each matching build row */
+    JOIN_INNER,
+    /* like JOIN_INNER, but probe rows without a match are padded with NULLs */
+    JOIN_LEFT,
+    /* each probe row which has at least one match, without build columns (EXISTS) */
+    JOIN_SEMI,
+    /* each probe row which has no match, without build columns (NOT EXISTS) */
+    JOIN_ANTI,
+    /*
+     * each probe row followed by a mark column for (probe key IN build keys):
+     * TRUE if it has a match, otherwise NULL if the probe key or any of the
+     * build keys is NULL, otherwise FALSE. FALSE for an empty build side.
+     * NOT IN is true exactly where the mark is FALSE.
+     */
+    JOIN_MARK
+};
+
+enum ProbeMode {
+    /* interleave probes once the table is too large for the cache */
+    PROBE_AUTO,
+    /* hash, look up and compare one probe row at a time */
+    PROBE_SIMPLE,
+    /*
+     * hash a group of probe rows and prefetch their buckets, then look up the
+     * buckets and prefetch the first row of each chain, and only then compare
+     * keys, so the cache misses of a group overlap instead of stalling in turn
+     */
+    PROBE_INTERLEAVED
+};
+
+/*
+ * Build side of a hash join. Build rows, their hashes and their key values
+ * are kept in contiguous arrays indexed by row number. Each bucket holds
+ * the number of the first row of its chain, and rows of the same bucket
+ * are chained through the next array. Buckets also keep a 16-bit tag with
+ * one bit set per hash in the chain, so most probes of keys which are not
+ * in the table are answered without touching any row.
+ */
+class JoinHashTable {
+public:
+    static constexpr uint32_t END = 0xffffffff;
+
+    JoinHashTable(size_t keyCount): keyCount(keyCount) {}
+
+    /* key must have keyCount values, none of them NULL */
+    void add(TupleP row, Datum *const *key, size_t hash);
+
+    /* links rows into buckets, must be called after the last add() */
+    void finalize();
+
+    /* first row of the chain which may contain rows with the given hash */
+    uint32_t first(size_t hash) const {
+        uint64_t bucket = buckets[hash & bucketMask];
+        if (!(bucket & tagOf(hash)))
+            return END;
+        return (uint32_t) bucket;
+    }
+
+    uint32_t next(uint32_t row) const { return nextRow[row]; }
+
+    void prefetchBucket(size_t hash) const {
+        __builtin_prefetch(&buckets[hash & bucketMask]);
+    }
+
+    /* prefetches what matches() reads first */
+    void prefetchRow(uint32_t row) const {
+        __builtin_prefetch(&hashes[row]);
+        __builtin_prefetch(&keys[row * keyCount]);
+    }
+
+    /* true if the given row has the given hash and key */
+    bool matches(uint32_t row, Datum *const *key, size_t hash) const;
+
+    const Tuple &row(uint32_t row) const { return *rows[row]; }
+    size_t size() const { return rows.size(); }
+
+    /* hash of each row, and keyCount key values per row */
+    const std::vector<size_t> &getHashes() const { return hashes; }
+    const std::vector<DatumP> &getKeys() const { return keys; }
+
+private:
+    size_t keyCount;
+    std::vector<TupleP> rows;
+    std::vector<size_t> hashes;
+    std::vector<DatumP> keys;
+    std::vector<uint32_t> nextRow;
+    /* tag in the high 32 bits, first row of the chain in the low 32 bits */
+    std::vector<uint64_t> buckets;
+    size_t bucketMask = 0;
+
+    static uint64_t tagOf(size_t hash) {
+        return 1ULL << (32 + (hash >> 60));
+    }
+};
+
+/*
+ * Filter on the probe keys of a join, which the join pushes down into its
+ * probe child so that rows which can't match are dropped before they reach
+ * it. Once the build side has been read, the join publishes a Bloom filter
+ * of the build key hashes and the range of each build key column. Rows
+ * with a NULL key, a key outside the range, or a hash not in the Bloom
+ * filter are dropped. Every row passes until the filter is published.
+ */
+class JoinKeyFilter: public RowFilter {
+public:
+    /* probeKeys are evaluated on the rows to filter, and must outlive the filter */
+    JoinKeyFilter(std::vector<std::unique_ptr<Expr>> &probeKeys): probeKeys(probeKeys) {}
+
+    bool pass(const Tuple &tuple) override;
+
+    /* hashes has one entry and keys has one value per key column for each build row */
+    void publish(const std::vector<size_t> &hashes, const std::vector<DatumP> &keys);
+
+    size_t rowsDropped() const { return dropped; }
+
+private:
+    std::vector<std::unique_ptr<Expr>> &probeKeys;
+    bool published = false;
+    BloomFilter bloom;
+    /* smallest and largest value of each key column, empty if there are no build rows */
+    std::vector<DatumP> minKey, maxKey;
+    std::vector<Datum *> key;
+    size_t dropped = 0;
+};
+
+/*
+ * Hash join. The build child is read into a JoinHashTable the first time a
+ * tuple is requested, and then probe rows are streamed through it. Output
+ * tuples consist of the probe columns followed by the build columns, except
+ * for JOIN_SEMI and JOIN_ANTI which only return probe columns, and JOIN_MARK
+ * which returns probe columns and the mark. NULL keys never match. Semi,
+ * anti and mark joins stop probing a row at its first match, and return
+ * each probe row at most once.
+ */
+class ExecHashJoin: public ExecNode, public PipelineSink {
+public:
+    /*
+     * buildWidth is the number of build columns, which is used to pad
+     * unmatched rows of JOIN_LEFT and must be given for it. Inner and
+     * semi joins push a JoinKeyFilter into the probe child, if it accepts
+     * row filters.
+     */
+    ExecHashJoin(std::unique_ptr<ExecNode> probe, std::unique_ptr<ExecNode> build,
+                 std::vector<std::unique_ptr<Expr>> probeKeys,
+                 std::vector<std::unique_ptr<Expr>> buildKeys,
+                 JoinType type = JOIN_INNER, size_t buildWidth = 0,
+                 ProbeMode probeMode = PROBE_AUTO);
+    Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    void stop() override { probe->stop(); build->stop(); }
+    void fusePipelines() override { probe->fusePipelines(); build->fusePipelines(); }
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override {
+        probe->eliminateCommonExprs();
+        build->eliminateCommonExprs();
+    }
+
+    /* the build side is a pipeline breaker, whose rows are pushed into the join */
+    void addPipelines(PipelineExecutor &executor) override;
+    void consume(Tuple *const *rows, size_t n) override;
+    void finish() override;
+
+    /* filter pushed into the probe child, or NULL if there's none */
+    const JoinKeyFilter *getKeyFilter() const { return keyFilter.get(); }
+
+    /* build rows from which PROBE_AUTO interleaves probes */
+    static constexpr size_t interleaveRows = 1 << 16;
+    /* probe rows whose lookups are overlapped by PROBE_INTERLEAVED */
+    static constexpr size_t probeGroupSize = 16;
+private:
+    std::unique_ptr<ExecNode> probe;
+    std::unique_ptr<ExecNode> build;
+    std::vector<std::unique_ptr<Expr>> probeKeys;
+    std::vector<std::unique_ptr<Expr>> buildKeys;
+    JoinType type;
+    size_t buildWidth;
+    ProbeMode probeMode;
+
+    JoinHashTable table;
+    std::shared_ptr<JoinKeyFilter> keyFilter;
+    bool built = false;
+    size_t buildRows = 0;
+    bool buildHasNullKeys = false;
+
+    /* probe row being joined, its key and the next candidate build row */
+    Tuple *probeTuple = NULL;
+    std::vector<Datum *> probeKey;
+    size_t probeHash = 0;
+    bool probeKeyNull = false;
+    uint32_t candidate = JoinHashTable::END;
+    bool probeMatched = false;
+
+    /*
+     * batch of probe rows of PROBE_INTERLEAVED. Rows before stagedEnd have
+     * their hash and the first row of their chain computed. The keys of
+     * the staged group are copied into stagedKeys, keyCount per row, since
+     * the values an expression returns may not outlive its next evaluation.
+     */
+    bool interleaved = false;
+    std::vector<Tuple *> probeBatch;
+    std::vector<size_t> batchHashes;
+    std::vector<uint32_t> batchCandidates;
+    std::vector<char> batchKeyNull;
+    std::vector<DatumP> stagedKeys;
+    size_t batchPos = 0, stagedEnd = 0;
+
+    Tuple result;
+
+    void buildTable();
+    bool nextProbeRow();
+    void stageProbeGroup();
+};
+
+/*
+ * Hash join for build sides which don't fit in the cache. Both inputs are
+ * materialized and radix-partitioned on their key hashes, in one pass, or
+ * in two passes if a single pass would scatter rows to more partitions than
+ * the TLB can cover. Matching partition pairs are then joined in parallel
+ * by worker threads, each using a hash table small enough to stay in the
+ * cache. Output has the same format as ExecHashJoin, grouped by partition.
+ */
+class ExecRadixJoin: public ExecNode {
+public:
+    /*
+     * threads == 0 uses one thread per core, and radixBits < 0 picks the
+     * number of partitions from the size of the build side. Key filters
+     * are pushed down like in ExecHashJoin.
+     */
+    ExecRadixJoin(std::unique_ptr<ExecNode> probe, std::unique_ptr<ExecNode> build,
+                  std::vector<std::unique_ptr<Expr>> probeKeys,
+                  std::vector<std::unique_ptr<Expr>> buildKeys,
+                  JoinType type = JOIN_INNER, size_t buildWidth = 0,
+                  size_t threads = 0, int radixBits = -1);
+    Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    void stop() override { probe->stop(); build->stop(); }
+    void fusePipelines() override { probe->fusePipelines(); build->fusePipelines(); }
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override {
+        probe->eliminateCommonExprs();
+        build->eliminateCommonExprs();
+    }
+    void addPipelines(PipelineExecutor &executor) override {
+        probe->addPipelines(executor);
+        build->addPipelines(executor);
+    }
+
+    const JoinKeyFilter *getKeyFilter() const { return keyFilter.get(); }
+
+    /* build rows per partition aimed at, so that a partition's table fits in the cache */
+    static constexpr size_t partitionRows = 4096;
+    /* bits per partitioning pass, so that the scatter targets fit in the TLB */
+    static constexpr int maxPassBits = 7;
+private:
+    /* materialized input, with row numbers ordered by partition */
+    struct Side {
+        std::vector<TupleP> rows;
+        std::vector<DatumP> keys;
+        std::vector<size_t> hashes;
+        std::vector<uint32_t> order;
+        /* partition p is order[bounds[p]] to order[bounds[p + 1] - 1] */
+        std::vector<size_t> bounds;
+    };
+
+    std::unique_ptr<ExecNode> probe;
+    std::unique_ptr<ExecNode> build;
+    std::vector<std::unique_ptr<Expr>> probeKeys;
+    std::vector<std::unique_ptr<Expr>> buildKeys;
+    JoinType type;
+    size_t buildWidth;
+    size_t threads;
+    int radixBits;
+
+    std::shared_ptr<JoinKeyFilter> keyFilter;
+    Side probeSide, buildSide;
+    size_t buildRows = 0;
+    bool buildHasNullKeys = false;
+    /* probe rows with NULL keys, which can only be returned unmatched */
+    std::vector<uint32_t> nullKeyRows;
+    /*
+     * (probe row, build row) pairs of each partition. Build row is END for
+     * unmatched probe rows, and MATCHED for a match of JOIN_MARK.
+     */
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> matches;
+    bool joined = false;
+    size_t nextPartition = 0, nextMatch = 0, nextNullKeyRow = 0;
+
+    Tuple result;
+
+    static constexpr uint32_t MATCHED = JoinHashTable::END - 1;
+
+    void join();
+    void readSide(ExecNode &node, std::vector<std::unique_ptr<Expr>> &exprs,
+                  Side &side, bool isProbe);
+    void partition(Side &side, int bits);
+    void joinPartition(size_t p);
+};
+
+/*
+ * Evaluates a key expression of a join through the pointer which owns it,
+ * so it follows rewrites of the expression. Lets an ExecSort below a merge
+ * join sort on the keys of the join.
+ */
+class JoinKeyRef: public Expr {
+public:
+    JoinKeyRef(std::unique_ptr<Expr> &key): key(key) {}
+    Datum *eval(const Tuple &tuple) override {
+        return key->eval(tuple);
+    }
+private:
+    std::unique_ptr<Expr> &key;
+};
+
+/*
+ * Merge join of inputs which are both ordered on their join keys, so it
+ * needs no hash table. Keys are compared in their normalized form. Only
+ * the build rows of the current key are kept in memory, which handles
+ * duplicate keys on both sides. If sortInputs is set, each input is read
+ * through an ExecSort on its keys, which spills to disk if it's large.
+ * Output has the same format as ExecHashJoin. JOIN_MARK isn't supported,
+ * since whether the build side has NULL keys isn't known until it's read
+ * to the end.
+ */
+class ExecMergeJoin: public ExecNode {
+public:
+    ExecMergeJoin(std::unique_ptr<ExecNode> probe, std::unique_ptr<ExecNode> build,
+                  std::vector<std::unique_ptr<Expr>> probeKeys,
+                  std::vector<std::unique_ptr<Expr>> buildKeys,
+                  JoinType type = JOIN_INNER, size_t buildWidth = 0,
+                  bool sortInputs = false);
+    Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    void stop() override { probe->stop(); build->stop(); }
+    void fusePipelines() override { probe->fusePipelines(); build->fusePipelines(); }
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override {
+        probe->eliminateCommonExprs();
+        build->eliminateCommonExprs();
+    }
+    void addPipelines(PipelineExecutor &executor) override {
+        probe->addPipelines(executor);
+        build->addPipelines(executor);
+    }
+private:
+    std::unique_ptr<ExecNode> probe;
+    std::unique_ptr<ExecNode> build;
+    std::vector<std::unique_ptr<Expr>> probeKeys;
+    std::vector<std::unique_ptr<Expr>> buildKeys;
+    JoinType type;
+    size_t buildWidth;
+
+    /* build rows of the current key, and the key itself, normalized */
+    std::vector<TupleP> group;
+    std::string groupKey;
+    /* first build row after the current group */
+    TupleP buildNext;
+    std::string buildNextKey;
+    bool buildStarted = false;
+
+    Tuple *probeTuple = NULL;
+    std::vector<Datum *> probeKey;
+    std::string probeNormKey;
+    size_t nextGroupRow = 0;
+
+    Tuple result;
+
+    void readBuildRow();
+    bool advanceBuild(const std::string &key);
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+/*
+ * Reduction kernels over a column of values, or over the positions of a
+ * column listed in a selection vector. They keep reduceLanes independent
+ * accumulators, which the compiler can keep in SIMD registers without
+ * having to reorder floating point additions. Sums are added up as Sum,
+ * which can be wider than the values so they don't overflow.
+ */
+const size_t reduceLanes = 8;
+
+template <class T, class Sum = T>
+Sum sumKernel(const T *values, size_t n) {
+    Sum lanes[reduceLanes] = {};
+    size_t i = 0;
+    for (; i + reduceLanes <= n; i += reduceLanes) {
+        for (size_t j = 0; j < reduceLanes; j++)
+            lanes[j] += values[i + j];
+    }
+    for (; i < n; i++)
+        lanes[0] += values[i];
+    Sum result = 0;
+    for (size_t j = 0; j < reduceLanes; j++)
+        result += lanes[j];
+    return result;
+}
+
+template <class T, class Sum = T>
+Sum sumKernel(const T *values, const uint32_t *sel, size_t n) {
+    Sum lanes[reduceLanes] = {};
+    size_t i = 0;
+    for (; i + reduceLanes <= n; i += reduceLanes) {
+        for (size_t j = 0; j < reduceLanes; j++)
+            lanes[j] += values[sel[i + j]];
+    }
+    for (; i < n; i++)
+        lanes[0] += values[sel[i]];
+    Sum result = 0;
+    for (size_t j = 0; j < reduceLanes; j++)
+        result += lanes[j];
+    return result;
+}
+
+/* minimum of init and the values */
+template <class T>
+T minKernel(const T *values, size_t n, T init) {
+    T lanes[reduceLanes];
+    for (size_t j = 0; j < reduceLanes; j++)
+        lanes[j] = init;
+    size_t i = 0;
+    for (; i + reduceLanes <= n; i += reduceLanes) {
+        for (size_t j = 0; j < reduceLanes; j++)
+            lanes[j] = values[i + j] < lanes[j] ? values[i + j] : lanes[j];
+    }
+    for (; i < n; i++)
+        lanes[0] = values[i] < lanes[0] ? values[i] : lanes[0];
+    T result = init;
+    for (size_t j = 0; j < reduceLanes; j++)
+        result = lanes[j] < result ? lanes[j] : result;
+    return result;
+}
+
+template <class T>
+T minKernel(const T *values, const uint32_t *sel, size_t n, T init) {
+    T result = init;
+    for (size_t i = 0; i < n; i++)
+        result = values[sel[i]] < result ? values[sel[i]] : result;
+    return result;
+}
+
+/* maximum of init and the values */
+template <class T>
+T maxKernel(const T *values, size_t n, T init) {
+    T lanes[reduceLanes];
+    for (size_t j = 0; j < reduceLanes; j++)
+        lanes[j] = init;
+    size_t i = 0;
+    for (; i + reduceLanes <= n; i += reduceLanes) {
+        for (size_t j = 0; j < reduceLanes; j++)
+            lanes[j] = lanes[j] < values[i + j] ? values[i + j] : lanes[j];
+    }
+    for (; i < n; i++)
+        lanes[0] = lanes[0] < values[i] ? values[i] : lanes[0];
+    T result = init;
+    for (size_t j = 0; j < reduceLanes; j++)
+        result = result < lanes[j] ? lanes[j] : result;
+    return result;
+}
+
+template <class T>
+T maxKernel(const T *values, const uint32_t *sel, size_t n, T init) {
+    T result = init;
+    for (size_t i = 0; i < n; i++)
+        result = result < values[sel[i]] ? values[sel[i]] : result;
+    return result;
+}
+
+/*
+ * Exact sum of doubles, whose result doesn't depend on the order in which
+ * values are added, how they are split into batches, or how partial sums
+ * are merged. Each finite value is added as the integer it is a multiple
+ * of 2^-1074 of, into digits of 32 bits kept in int64 counters, so adding
+ * and merging are exact integer additions. Infinities and NaNs are summed
+ * apart. result() rounds the exact sum to a double, from its canonical
+ * form, so the same sum always gives the same bits. The state takes
+ * digitCount * 8 bytes.
+ */
+struct DeterministicSum {
+    /* 2046 positions of the lowest mantissa bit, 85 bits above it, and room for carries */
+    static constexpr size_t digitCount = 70;
+    /* additions after which each digit still fits its counter */
+    static constexpr unsigned pendingMax = 1u << 30;
+
+    int64_t digits[digitCount] = {};
+    unsigned pending = 0;
+    bool hasSpecial = false;
+    double special = 0;
+
+    void add(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        int exponent = (int) (bits >> 52 & 0x7ff);
+        uint64_t mantissa = bits & ((1ULL << 52) - 1);
+        if (exponent == 0x7ff) {
+            special = hasSpecial ? special + value : value;
+            hasSpecial = true;
+            return;
+        }
+        /* value is mantissa * 2^(position - 1074) */
+        int position = 0;
+        if (exponent > 0) {
+            mantissa |= 1ULL << 52;
+            position = exponent - 1;
+        }
+        size_t digit = position / 32;
+        int shift = position % 32;
+        uint64_t low = mantissa << shift;
+        uint64_t high = shift ? mantissa >> (64 - shift) : 0;
+        int64_t sign = (bits >> 63) ? -1 : 1;
+        digits[digit] += sign * (int64_t) (low & 0xffffffff);
+        digits[digit + 1] += sign * (int64_t) (low >> 32);
+        digits[digit + 2] += sign * (int64_t) high;
+        if (++pending == pendingMax)
+            normalize();
+    }
+
+    void add(const double *values, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            add(values[i]);
+    }
+
+    void add(const double *values, const uint32_t *sel, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            add(values[sel[i]]);
+    }
+
+    void merge(const DeterministicSum &other) {
+        normalize();
+        for (size_t j = 0; j < digitCount; j++)
+            digits[j] += other.digits[j];
+        normalize();
+        if (other.hasSpecial) {
+            special = hasSpecial ? special + other.special : other.special;
+            hasSpecial = true;
+        }
+    }
+
+    double result() const {
+        if (hasSpecial)
+            return special;
+        DeterministicSum canonical = *this;
+        canonical.normalize();
+        int64_t *d = canonical.digits;
+        /* the top digit holds the sign, the magnitude is rounded */
+        bool negative = d[digitCount - 1] < 0;
+        if (negative) {
+            int64_t borrow = 0;
+            for (size_t j = 0; j < digitCount; j++) {
+                int64_t negated = -d[j] - borrow;
+                borrow = negated < 0;
+                d[j] = negated + (borrow << 32);
+            }
+        }
+        double total = 0;
+        for (size_t j = digitCount; j-- > 0;) {
+            if (d[j])
+                total += std::ldexp((double) d[j], (int) (32 * j) - 1074);
+        }
+        return negative ? -total : total;
+    }
+
+private:
+    /* moves carries up, so all digits but the top one are in [0, 2^32) */
+    void normalize() {
+        for (size_t j = 0; j + 1 < digitCount; j++) {
+            int64_t carry = digits[j] >> 32;
+            digits[j] -= carry * ((int64_t) 1 << 32);
+            digits[j + 1] += carry;
+        }
+        pending = 0;
+    }
+};
+
+#endif
@@ -20,13 +20,17 @@ const int l_shipdate = 10;
 
 static vector<TupleP> readLineitem();
 static unique_ptr<ExecNode> tpchQuery6(vector<TupleP> tuples);
+static unique_ptr<Expr> decimalExpr(double left, ArithOp op, double right);
 
 int main() {
     clock_t c1 = clock();
     unique_ptr<ExecNode> q6 = tpchQuery6(readLineitem());
+    q6->visitExprs(simplifyExpr);
+    q6->eliminateCommonExprs();
+    PipelineExecutor executor(*q6);
     cout << "Loaded!" << endl;
     clock_t c2 = clock();
-    vector<TupleP> result = q6->eval();
+    vector<TupleP> result = executor.run();
     clock_t c3 = clock();
     cout << fixed << showpoint << setprecision(6);
     cout << "Rows: " << result.size() << endl;
@@ -63,19 +67,23 @@ static unique_ptr<ExecNode> tpchQuery6(vector<TupleP> tuples) {
     filterExpr = AndExpr::make(
         move(filterExpr),
         CompareExpr::make(VarExpr::make(l_discount),
-                          ConstExpr::makeDecimal(0.06 - 0.01 - 1e-6), GTE)
+                          ArithExpr::make(decimalExpr(0.06, SUBTRACT, 0.01),
+                                          ConstExpr::makeDecimal(1e-6), SUBTRACT),
+                          GTE)
     );
     /* AND l_discount <= 0.06 + 0.01 */
     filterExpr = AndExpr::make(
         move(filterExpr),
         CompareExpr::make(VarExpr::make(l_discount),
-                          ConstExpr::makeDecimal(0.06 + 0.01 + 1e-6), LTE)
+                          ArithExpr::make(decimalExpr(0.06, ADD, 0.01),
+                                          ConstExpr::makeDecimal(1e-6), ADD),
+                          LTE)
     );
-    /* AND l_quantity < 100.0 */
+    /* AND l_quantity < 24 */
     filterExpr = AndExpr::make(
         move(filterExpr),
         CompareExpr::make(VarExpr::make(l_quantity),
-                          ConstExpr::makeDecimal(24 - 1e-6), LT)
+                          decimalExpr(24, SUBTRACT, 1e-6), LT)
     );
     auto filterNode = make_unique<ExecFilter>(move(scanNode), move(filterExpr));
     
@@ -91,3 +99,8 @@ static unique_ptr<ExecNode> tpchQuery6(vector<TupleP> tuples) {
     auto aggNode = make_unique<ExecAgg>(move(filterNode), groupBy, move(aggFuncCalls));
     return aggNode;
 }
+
+/* the bounds are written as in the query, and folded by simplifyExpr() */
+static unique_ptr<Expr> decimalExpr(double left, ArithOp op, double right) {
+    return ArithExpr::make(ConstExpr::makeDecimal(left), ConstExpr::makeDecimal(right), op);
+}
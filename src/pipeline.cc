@@ -0,0 +1,174 @@
+#include <pipeline.h>
+#include <rowstore.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+using namespace std;
+
+/* Pipeline */
+void Pipeline::setSource(ExecNode &node) {
+    source = &node;
+    stages.clear();
+    batchFilters = 0;
+}
+
+void Pipeline::addFilter(Expr &expr, const vector<shared_ptr<RowFilter>> &rowFilters,
+                         CommonExprs *commonExprs)
+{
+    if (batchFilters == stages.size())
+        batchFilters++;
+    stages.push_back(Stage { STAGE_FILTER, &expr, &rowFilters, NULL, commonExprs });
+}
+
+void Pipeline::addProjection(vector<unique_ptr<Expr>> &exprs, CommonExprs *commonExprs) {
+    Stage stage { STAGE_PROJECT, NULL, NULL, &exprs, commonExprs };
+    for (size_t i = 0; i < ExecNode::batchSize; i++)
+        stage.outputs.push_back(make_unique<Tuple>());
+    stages.push_back(move(stage));
+}
+
+void Pipeline::run(PipelineSink &sink) {
+    size_t n;
+    while ((n = source->nextBatch(input))) {
+        n = runBatchFilters(n);
+        output.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (Tuple *row = runStages(input[i]))
+                output.push_back(row);
+        }
+        if (!output.empty())
+            sink.consume(output.data(), output.size());
+    }
+}
+
+/* moves the first n rows of input which pass the leading filters to the front */
+size_t Pipeline::runBatchFilters(size_t n) {
+    for (size_t i = 0; i < batchFilters && n > 0; i++) {
+        if (stages[i].commonExprs)
+            stages[i].commonExprs->nextRows();
+        n = stages[i].filter->select(input.data(), n);
+        size_t passed = 0;
+        for (size_t j = 0; j < n; j++) {
+            bool pass = true;
+            for (const auto &filter: *stages[i].rowFilters)
+                pass = pass && filter->pass(*input[j]);
+            if (pass)
+                input[passed++] = input[j];
+        }
+        n = passed;
+    }
+    return n;
+}
+
+/*
+ * Runs the stages after the batch filters on a row, and returns the row as
+ * the last stage returns it, or NULL if a filter drops it. A
+ * projection writes its result into the tuple of the position the row
+ * will have in the output batch, so results stay valid until it's pushed.
+ */
+Tuple *Pipeline::runStages(Tuple *row) {
+    for (size_t i = batchFilters; i < stages.size(); i++) {
+        Stage &stage = stages[i];
+        /* later stages may reuse the rows of dropped ones, so results are dropped per row */
+        if (stage.commonExprs)
+            stage.commonExprs->nextRows();
+        if (stage.type == STAGE_FILTER) {
+            if (!static_cast<const BoolDatum *>(stage.filter->eval(*row))->value)
+                return NULL;
+            for (const auto &filter: *stage.rowFilters) {
+                if (!filter->pass(*row))
+                    return NULL;
+            }
+        } else {
+            Tuple &projected = *stage.outputs[output.size()];
+            ExecProject::projectInto(*stage.exprs, *row, projected);
+            row = &projected;
+        }
+    }
+    return row;
+}
+
+/* PipelineExecutor */
+PipelineExecutor::PipelineExecutor(ExecNode &plan) {
+    addPipeline(plan, results);
+}
+
+void PipelineExecutor::addPipeline(ExecNode &input, PipelineSink &sink) {
+    auto pipeline = make_unique<Pipeline>();
+    input.addToPipeline(*pipeline);
+    size_t first = tasks.size();
+    pipeline->getSource().addPipelines(*this);
+    Task task { move(pipeline), &sink, {} };
+    for (size_t i = first; i < tasks.size(); i++)
+        task.dependencies.push_back(i);
+    tasks.push_back(move(task));
+}
+
+/*
+ * Tasks are added after the tasks they depend on, so each worker starts
+ * the first task whose dependencies are done, or waits for one to finish.
+ */
+vector<TupleP> PipelineExecutor::run(size_t threads) {
+    if (ran)
+        throw logic_error("PipelineExecutor can only run once");
+    ran = true;
+    if (threads == 0)
+        threads = max(thread::hardware_concurrency(), 1u);
+    threads = min(threads, tasks.size());
+
+    mutex lock;
+    condition_variable changed;
+    vector<bool> started(tasks.size()), done(tasks.size());
+    size_t finished = 0;
+    exception_ptr error;
+
+    auto worker = [&]() {
+        unique_lock<mutex> guard(lock);
+        while (finished < tasks.size() && !error) {
+            size_t next = 0;
+            for (; next < tasks.size(); next++) {
+                bool ready = !started[next];
+                for (size_t dependency: tasks[next].dependencies)
+                    ready = ready && done[dependency];
+                if (ready)
+                    break;
+            }
+            if (next == tasks.size()) {
+                changed.wait(guard);
+                continue;
+            }
+            started[next] = true;
+            guard.unlock();
+            try {
+                tasks[next].pipeline->run(*tasks[next].sink);
+                tasks[next].sink->finish();
+            } catch (...) {
+                guard.lock();
+                error = current_exception();
+                changed.notify_all();
+                break;
+            }
+            guard.lock();
+            done[next] = true;
+            finished++;
+            changed.notify_all();
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < threads; i++)
+        workers.emplace_back(worker);
+    worker();
+    for (thread &t: workers)
+        t.join();
+    if (error)
+        rethrow_exception(error);
+    return move(results.rows);
+}
+
+/* rows pushed into the sink are borrowed from the pipeline, so they are copied */
+void PipelineExecutor::ResultSink::consume(Tuple *const *rows, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        this->rows.push_back(cloneTuple(*rows[i]));
+}
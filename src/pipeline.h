@@ -0,0 +1,126 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <tuple.h>
+#include <expr.h>
+#include <vector>
+#include <memory>
+
+class ExecNode;
+class RowFilter;
+
+/* receives the rows a pipeline pushes into it */
+class PipelineSink {
+public:
+    virtual ~PipelineSink() {}
+    /* the rows stay valid until the call returns */
+    virtual void consume(Tuple *const *rows, size_t n) = 0;
+
+    /* called once all rows have been pushed */
+    virtual void finish() {}
+};
+
+/*
+ * A chain of non-blocking operators fused into a single loop. Batches of
+ * rows are read from the source, and each row runs through all stages in
+ * turn before the next row is looked at, instead of each operator going
+ * over the whole batch and handing it to the next one. Rows which pass
+ * are collected into a batch which is pushed into the sink. Filters before
+ * the first projection run on the whole batch with Expr::select() though,
+ * which lets conjunctions adapt the order of their conjuncts.
+ *
+ * Stages don't own their expressions, which belong to the operators that
+ * added them, so the operators must outlive the pipeline.
+ */
+class Pipeline {
+public:
+    void setSource(ExecNode &node);
+    ExecNode &getSource() { return *source; }
+    /*
+     * Stages which are the first to evaluate the expressions sharing a
+     * CommonExprs drop its results before they read new rows.
+     */
+    void addFilter(Expr &expr, const std::vector<std::shared_ptr<RowFilter>> &rowFilters,
+                   CommonExprs *commonExprs = NULL);
+    void addProjection(std::vector<std::unique_ptr<Expr>> &exprs,
+                       CommonExprs *commonExprs = NULL);
+
+    /* pushes all rows of the source which pass the stages into sink */
+    void run(PipelineSink &sink);
+
+    size_t stageCount() const { return stages.size(); }
+private:
+    enum StageType {
+        STAGE_FILTER,
+        STAGE_PROJECT
+    };
+
+    struct Stage {
+        StageType type;
+        Expr *filter;
+        const std::vector<std::shared_ptr<RowFilter>> *rowFilters;
+        std::vector<std::unique_ptr<Expr>> *exprs;
+        CommonExprs *commonExprs;
+        /* projected rows, one per position of the output batch */
+        std::vector<TupleP> outputs;
+    };
+
+    ExecNode *source = NULL;
+    std::vector<Stage> stages;
+    /* leading filter stages, which are run on whole batches */
+    size_t batchFilters = 0;
+    std::vector<Tuple *> input;
+    std::vector<Tuple *> output;
+
+    size_t runBatchFilters(size_t n);
+    Tuple *runStages(Tuple *row);
+};
+
+/*
+ * Push-based execution of a plan. The plan is cut into pipelines at its
+ * pipeline breakers, the nodes which read all of their input before they
+ * return a row, such as hashed aggregates, sorts and hash join build sides.
+ * Each breaker is the sink of a pipeline from its input, and the plan's
+ * rows are pushed into a result sink by a last pipeline. Nodes which are
+ * neither stages nor breakers are pulled by the pipeline they are the
+ * source of, as are their inputs.
+ *
+ * A pipeline runs once all pipelines below its source have finished, and
+ * pipelines which don't depend on each other run in parallel. The plan is
+ * only borrowed, and must outlive the executor.
+ */
+class PipelineExecutor {
+public:
+    explicit PipelineExecutor(ExecNode &plan);
+
+    /* runs the pipelines, up to threads at a time, 0 meaning one per core */
+    std::vector<TupleP> run(size_t threads = 0);
+
+    /*
+     * Adds a pipeline which pushes the rows of input into sink, after the
+     * pipelines the source of that pipeline depends on. Called by the
+     * nodes of the plan from ExecNode::addPipelines().
+     */
+    void addPipeline(ExecNode &input, PipelineSink &sink);
+
+    size_t pipelineCount() const { return tasks.size(); }
+private:
+    struct Task {
+        std::unique_ptr<Pipeline> pipeline;
+        PipelineSink *sink;
+        /* tasks which have to be finished first */
+        std::vector<size_t> dependencies;
+    };
+
+    class ResultSink: public PipelineSink {
+    public:
+        std::vector<TupleP> rows;
+        void consume(Tuple *const *rows, size_t n) override;
+    };
+
+    std::vector<Task> tasks;
+    ResultSink results;
+    bool ran = false;
+};
+
+#endif
@@ -6,126 +6,322 @@
 #include <map>
 using namespace std;
 
-/* explicit template instantiations */
-template class AggSum<int>;
-template class AggSum<double>;
-template class AggSum<long long>;
+static bool passRowFilters(const vector<shared_ptr<RowFilter>> &filters,
+                           const Tuple &tuple);
+static shared_ptr<CommonExprs> shareWithFilters(vector<unique_ptr<Expr> *> exprs,
+                                                ExecNode &child);
 
 /* Exec Node */
 vector<TupleP> ExecNode::eval() {
     vector<TupleP> result;
-    while (true) {
-        Tuple* next = nextTuple();
-        if (next) {
-            result.push_back(cloneTuple(*next));
-        } else {
-            break;
-        }
-    }
+    while (TupleP next = takeTuple())
+        result.push_back(move(next));
     return result;
 }
 
-/* AggSum */
-template <class inputType>
-DatumP AggSum<inputType>::init() {
-    return make_unique<NumericDatum<inputType>>(0);
+TupleP ExecNode::takeTuple() {
+    Tuple *tuple = nextTuple();
+    return tuple ? cloneTuple(*tuple) : NULL;
 }
 
-template <class inputType>
-void AggSum<inputType>::aggregate(Datum &state, const Datum &next) {
-    auto numericState = static_cast<NumericDatum<inputType> *>(&state);
-    auto *nextNumber = static_cast<const NumericDatum<inputType> *>(&next);
-    numericState->value += nextNumber->value;
+size_t ExecNode::nextBatch(vector<Tuple *> &batch) {
+    batch.clear();
+    batchCopies.clear();
+    TupleP tuple;
+    while (batch.size() < batchSize && (tuple = takeTuple())) {
+        batchCopies.push_back(move(tuple));
+        batch.push_back(batchCopies.back().get());
+    }
+    return batch.size();
 }
 
-template <class inputType>
-DatumP AggSum<inputType>::finalize(Datum &state) {
-    return state.clone();
+/* GroupStatePool */
+char *GroupStatePool::allocate() {
+    if (!freeBlocks.empty()) {
+        char *block = freeBlocks.back();
+        freeBlocks.pop_back();
+        return block;
+    }
+    if (chunkUsed == blocksPerChunk) {
+        chunks.push_back(make_unique<char[]>(blockSize * blocksPerChunk));
+        chunkUsed = 0;
+    }
+    return chunks.back().get() + blockSize * chunkUsed++;
 }
 
-/* AggFuncCall */
-DatumP AggFuncCall::init() {
-    return func->init();
+/* PreAggTable */
+PreAggTable::Entry &PreAggTable::probe(const Tuple &tuple,
+                                       const vector<int> &groupBy, size_t hash)
+{
+    size_t mask = capacity - 1;
+    for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+        Entry &entry = entries[pos];
+        if (!entry.key)
+            return entry;
+        if (entry.hash != hash)
+            continue;
+        bool match = true;
+        for (size_t i = 0; i < groupBy.size() && match; i++)
+            match = (*(*entry.key)[i] == *tuple[groupBy[i]]);
+        if (match)
+            return entry;
+    }
 }
 
-void AggFuncCall::aggregate(Datum &state, const Tuple& next) {
-    func->aggregate(state, *(expr->eval(next)));
+void PreAggTable::insert(Entry &entry, size_t hash, TupleP key, char *state) {
+    entry.hash = hash;
+    entry.key = move(key);
+    entry.state = move(state);
+    used++;
 }
 
-void AggFuncCall::addResult(Datum &state, Tuple &tuple) {
-    tuple.push_back(func->finalize(state));
+void PreAggTable::clear() {
+    for (Entry &entry: entries) {
+        entry.key.reset();
+        entry.state = NULL;
+    }
+    used = 0;
 }
 
 /* ExecAgg */
+ExecAgg::ExecAgg(unique_ptr<ExecNode> child, vector<int> groupBy,
+                 vector<unique_ptr<AggFuncCall>> aggs, AggStrategy strategy):
+    child(move(child)), groupBy(groupBy), aggs(move(aggs)), strategy(strategy)
+{
+    /* lay out the states of all aggregates of a group in a single block */
+    size_t blockSize = 0;
+    for (const auto &agg: this->aggs) {
+        stateOffsets.push_back(blockSize);
+        size_t align = alignof(max_align_t);
+        blockSize += (agg->stateSize() + align - 1) / align * align;
+    }
+    statePool.setBlockSize(max(blockSize, (size_t) 1));
+}
+
+ExecAgg::~ExecAgg() {
+    if (currentState)
+        destroyGroupState(currentState);
+    if (singleState)
+        destroyGroupState(singleState);
+    for (pair<const string, Group> &p: groups)
+        destroyGroupState(p.second.state);
+    for (PreAggTable::Entry &entry: preAgg.getEntries()) {
+        if (entry.key)
+            destroyGroupState(entry.state);
+    }
+}
+
 std::vector<TupleP> ExecAgg::eval() {
-    if (groupBy.size() == 0)
-        return evalSingleGroup();
-    map<TupleP, TupleP, compareTupleP> aggState;
+    if (strategy == AGG_SORTED)
+        return ExecNode::eval();
+    if (pipeline) {
+        pipeline->run(*this);
+    } else {
+        vector<Tuple *> batch;
+        size_t n;
+        while ((n = child->nextBatch(batch)))
+            consume(batch.data(), n);
+    }
+    return finishGroups();
+}
 
-    Tuple *tuple;
-    while ((tuple = child->nextTuple())) {
-        TupleP groupKey = getGroupKey(*tuple);
-        auto it = aggState.find(groupKey);
-        /*
-         * if we already have a group with the same key, use that
-         * otherwise initialize a group.
-         */
-        Tuple *currentState;
-        if (it != aggState.end()) {
-            currentState = it->second.get();
-        } else {
-            TupleP initialState = make_unique<Tuple>();
-            currentState = initialState.get();
-            for (const auto &agg: aggs)
-                currentState->push_back(agg->init());
-            aggState[move(groupKey)] = move(initialState);
+void ExecAgg::fusePipelines() {
+    child->fusePipelines();
+    if (strategy == AGG_SORTED)
+        return;
+    pipeline = make_unique<Pipeline>();
+    child->addToPipeline(*pipeline);
+}
+
+/* hashed aggregates are pipeline breakers, sorted ones return groups as they go */
+void ExecAgg::addPipelines(PipelineExecutor &executor) {
+    if (strategy == AGG_SORTED)
+        child->addPipelines(executor);
+    else
+        executor.addPipeline(*child, *this);
+}
+
+void ExecAgg::visitExprs(const ExprVisitor &visit) {
+    child->visitExprs(visit);
+    for (auto &agg: aggs)
+        visit(agg->getExpr());
+}
+
+void ExecAgg::eliminateCommonExprs() {
+    vector<unique_ptr<Expr> *> exprs;
+    for (auto &agg: aggs)
+        exprs.push_back(&agg->getExpr());
+    commonExprs = shareWithFilters(exprs, *child);
+}
+
+void ExecAgg::finish() {
+    tuples = finishGroups();
+    tuplesCalculated = true;
+}
+
+void ExecAgg::consume(Tuple *const *rows, size_t n) {
+    if (commonExprs)
+        commonExprs->nextRows();
+    if (groupBy.size() == 0) {
+        if (!singleState)
+            singleState = initGroupState();
+        for (int i = 0; i < aggs.size(); i++)
+            aggs[i]->aggregateBatch(singleState + stateOffsets[i], rows, n);
+        return;
+    }
+
+    /*
+     * Find the group of each row first, and then add the rows to their
+     * groups one aggregate at a time.
+     *
+     * Rows first go through the pre-aggregation table, unless it has
+     * found out that keys don't repeat. In that case it only adds cost,
+     * so rows go straight to the main group table. Group keys of the
+     * whole batch are hashed before any lookup, so that the table
+     * entries can be prefetched.
+     */
+    states.resize(n);
+    if (preAggEnabled) {
+        batchHashes.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            batchHashes[i] = hashTuple(*rows[i], groupBy);
+            preAgg.prefetch(batchHashes[i]);
         }
-        /* Now add the current tuple to the group. */
-        for (int i = 0; i < aggs.size(); i++) {
-            aggs[i]->aggregate(*(*currentState)[i], *tuple);
+    }
+    size_t done = 0;
+    for (size_t i = 0; i < n; i++) {
+        char *state = NULL;
+        if (preAggEnabled && !(state = preAggregate(*rows[i], batchHashes[i]))) {
+            /* rows before this one still point into the full table */
+            aggregateBatch(states.data() + done, rows + done, i - done);
+            done = i;
+            flushPreAgg();
+            if (preAggEnabled)
+                state = preAggregate(*rows[i], batchHashes[i]);
         }
+        if (!state)
+            state = findOrCreateGroup(*rows[i]);
+        states[i] = state;
+    }
+    aggregateBatch(states.data() + done, rows + done, n - done);
+}
+
+/* results of the groups consumed so far, which are then released */
+vector<TupleP> ExecAgg::finishGroups() {
+    std::vector<TupleP> result;
+    if (groupBy.size() == 0) {
+        /* without group by, empty input still produces a single group */
+        if (!singleState)
+            singleState = initGroupState();
+        result.push_back(finalizeGroup(make_unique<Tuple>(), singleState));
+        destroyGroupState(singleState);
+        singleState = NULL;
+        return result;
     }
+    flushPreAgg();
 
     /*
      * Loop over all groups, then first add the group key,
      * and then add aggregate results.
      */
-    std::vector<TupleP> result;
-    for (const pair<const TupleP, TupleP> &p: aggState) {
-        TupleP resultTuple = make_unique<Tuple>();
-        for (const DatumP &datum: *(p.first)) {
-            resultTuple->push_back(datum->clone());
-        }
-        for (int i = 0; i < aggs.size(); i++) {
-            Datum &state = *((*(p.second))[i]);
-            aggs[i]->addResult(state, *resultTuple);
-        }
-        result.push_back(move(resultTuple));
+    for (pair<const string, Group> &p: groups) {
+        result.push_back(finalizeGroup(move(p.second.key), p.second.state));
+        destroyGroupState(p.second.state);
     }
+    groups.clear();
     return result;
 }
 
-vector<TupleP> ExecAgg::evalSingleGroup() {
-    TupleP state = make_unique<Tuple>();
-    for (const auto &agg: aggs)
-        state->push_back(agg->init());
-    Tuple *tuple;
-    while (tuple = child->nextTuple()) {
-        for (int i = 0; i < aggs.size(); i++) {
-            aggs[i]->aggregate(*((*state)[i]), *tuple);
-        }
-    }
-    TupleP resultTuple = make_unique<Tuple>();
+void ExecAgg::aggregateBatch(char *const *states, Tuple *const *rows, size_t n) {
+    for (size_t i = 0; i < aggs.size(); i++)
+        aggs[i]->aggregateBatch(states, stateOffsets[i], rows, n);
+}
+
+/* the group key followed by the aggregate results, built on the key */
+TupleP ExecAgg::finalizeGroup(TupleP key, const char *state) {
+    TupleP resultTuple = move(key);
     for (int i = 0; i < aggs.size(); i++) {
-        Datum &s = *((*state)[i]);
-        aggs[i]->addResult(s, *resultTuple);
+        aggs[i]->addResult(state + stateOffsets[i], *resultTuple);
     }
-    std::vector<TupleP> result;
-    result.push_back(move(resultTuple));
-    return result;
+    return resultTuple;
+}
+
+char *ExecAgg::initGroupState() {
+    char *state = statePool.allocate();
+    for (int i = 0; i < aggs.size(); i++)
+        aggs[i]->init(state + stateOffsets[i]);
+    return state;
+}
+
+void ExecAgg::destroyGroupState(char *state) {
+    for (int i = 0; i < aggs.size(); i++)
+        aggs[i]->destroy(state + stateOffsets[i]);
+    statePool.release(state);
+}
+
+/*
+ * if we already have a group with the same key, use that
+ * otherwise initialize a group.
+ */
+char *ExecAgg::findOrCreateGroup(const Tuple &tuple) {
+    normalizeColumns(normalizedKey, tuple, groupBy);
+    auto it = groups.find(normalizedKey);
+    if (it != groups.end())
+        return it->second.state;
+    char *state = initGroupState();
+    groups[normalizedKey] = Group { getGroupKey(tuple), state };
+    return state;
+}
+
+/*
+ * Returns the pre-aggregation state of the tuple's group, or NULL if the
+ * group is new and the table is full. hash is the hash of the group key.
+ */
+char *ExecAgg::preAggregate(const Tuple &tuple, size_t hash) {
+    PreAggTable::Entry &entry = preAgg.probe(tuple, groupBy, hash);
+    if (!entry.key) {
+        if (preAgg.full())
+            return NULL;
+        preAgg.insert(entry, hash, getGroupKey(tuple), initGroupState());
+    }
+    preAggRows++;
+    return entry.state;
+}
+
+/*
+ * Merges pre-aggregated groups into the main group table, and decides
+ * whether pre-aggregation is worth continuing by looking at how many rows
+ * were folded into each flushed group.
+ */
+void ExecAgg::flushPreAgg() {
+    if (preAgg.size() == 0)
+        return;
+    double reduction = 1.0 - (double) preAgg.size() / preAggRows;
+    for (PreAggTable::Entry &entry: preAgg.getEntries()) {
+        if (!entry.key)
+            continue;
+        normalizedKey.clear();
+        for (const DatumP &value: *entry.key)
+            normalizeDatum(normalizedKey, *value);
+        auto it = groups.find(normalizedKey);
+        if (it == groups.end()) {
+            groups[normalizedKey] = Group { move(entry.key), entry.state };
+            continue;
+        }
+        char *state = it->second.state;
+        for (int i = 0; i < aggs.size(); i++)
+            aggs[i]->merge(state + stateOffsets[i], entry.state + stateOffsets[i]);
+        destroyGroupState(entry.state);
+    }
+    preAgg.clear();
+    preAggRows = 0;
+    if (reduction < minPreAggReduction)
+        preAggEnabled = false;
 }
 
 Tuple* ExecAgg::nextTuple() {
+    if (strategy == AGG_SORTED)
+        return nextSortedGroup();
     if (!tuplesCalculated) {
         tuples = eval();
         tuplesCalculated = true;
@@ -135,6 +331,64 @@ Tuple* ExecAgg::nextTuple() {
     return NULL;
 }
 
+TupleP ExecAgg::takeTuple() {
+    if (strategy == AGG_SORTED)
+        return nextSortedGroup() ? move(lastResult) : NULL;
+    if (!nextTuple())
+        return NULL;
+    return move(tuples[nextTupleIndex - 1]);
+}
+
+/*
+ * Reads input until the group key changes, and returns the group which has
+ * just ended. The row which started the next group is aggregated into a
+ * fresh state right away, so child tuples are never held across calls.
+ */
+Tuple *ExecAgg::nextSortedGroup() {
+    if (inputDone)
+        return NULL;
+    Tuple *tuple;
+    while ((tuple = child->nextTuple())) {
+        if (commonExprs)
+            commonExprs->nextRows();
+        TupleP finishedGroup;
+        if (currentKey && !sameGroup(*currentKey, *tuple)) {
+            finishedGroup = finalizeGroup(move(currentKey), currentState);
+            destroyGroupState(currentState);
+        }
+        if (!currentKey) {
+            currentKey = getGroupKey(*tuple);
+            currentState = initGroupState();
+        }
+        for (int i = 0; i < aggs.size(); i++)
+            aggs[i]->aggregate(currentState + stateOffsets[i], *tuple);
+        if (finishedGroup) {
+            lastResult = move(finishedGroup);
+            return lastResult.get();
+        }
+    }
+    inputDone = true;
+    /* without group by, empty input still produces a single group */
+    if (!currentKey && groupBy.size() == 0) {
+        currentKey = make_unique<Tuple>();
+        currentState = initGroupState();
+    }
+    if (!currentKey)
+        return NULL;
+    lastResult = finalizeGroup(move(currentKey), currentState);
+    destroyGroupState(currentState);
+    currentState = NULL;
+    return lastResult.get();
+}
+
+bool ExecAgg::sameGroup(const Tuple &key, const Tuple &tuple) {
+    for (size_t i = 0; i < groupBy.size(); i++) {
+        if (*key[i] != *tuple[groupBy[i]])
+            return false;
+    }
+    return true;
+}
+
 TupleP ExecAgg::getGroupKey(const Tuple &tuple) {
     TupleP key = make_unique<Tuple>();
     for (int idx: groupBy)
@@ -144,46 +398,271 @@ TupleP ExecAgg::getGroupKey(const Tuple &tuple) {
 
 /* ExecScan */
 Tuple* ExecScan::nextTuple() {
-    if (nextTupleIndex < tuples.size())
-        return tuples[nextTupleIndex++].get();
+    while (nextTupleIndex < tuples.size() && !stopped.load(memory_order_relaxed)) {
+        Tuple *tuple = tuples[nextTupleIndex++].get();
+        if (passRowFilters(rowFilters, *tuple))
+            return tuple;
+    }
     return NULL;
 }
 
+size_t ExecScan::nextBatch(vector<Tuple *> &batch) {
+    batch.clear();
+    if (stopped.load(memory_order_relaxed))
+        return 0;
+    while (batch.size() < batchSize && nextTupleIndex < tuples.size()) {
+        Tuple *tuple = tuples[nextTupleIndex++].get();
+        if (passRowFilters(rowFilters, *tuple))
+            batch.push_back(tuple);
+    }
+    return batch.size();
+}
+
+bool ExecScan::addRowFilter(shared_ptr<RowFilter> filter) {
+    rowFilters.push_back(move(filter));
+    return true;
+}
+
 /* ExecFilter */
 Tuple* ExecFilter::nextTuple() {
     Tuple* tuple;
     while ((tuple = child->nextTuple())) {
+        if (commonExprs)
+            commonExprs->nextRows();
         Datum *exprResult = expr->eval(*tuple);
         auto exprResultBool = static_cast<const BoolDatum *>(exprResult);
-        if (exprResultBool->value) {
+        if (exprResultBool->value && passRowFilters(rowFilters, *tuple)) {
             return tuple;
         }
     }
     return NULL;
 }
 
+size_t ExecFilter::nextBatch(vector<Tuple *> &batch) {
+    while (child->nextBatch(batch)) {
+        if (commonExprs)
+            commonExprs->nextRows();
+        size_t selected = expr->select(batch.data(), batch.size());
+        size_t passed = 0;
+        for (size_t i = 0; i < selected; i++) {
+            if (passRowFilters(rowFilters, *batch[i]))
+                batch[passed++] = batch[i];
+        }
+        batch.resize(passed);
+        if (passed > 0)
+            return passed;
+    }
+    return 0;
+}
+
+bool ExecFilter::addRowFilter(shared_ptr<RowFilter> filter) {
+    rowFilters.push_back(move(filter));
+    return true;
+}
+
+void ExecFilter::addToPipeline(Pipeline &pipeline) {
+    child->addToPipeline(pipeline);
+    pipeline.addFilter(*expr, rowFilters, commonExprs.get());
+}
+
+/* filters without a projection or aggregate above share among themselves */
+void ExecFilter::eliminateCommonExprs() {
+    shareWithFilters({}, *this);
+}
+
 /* ExecProject */
 Tuple* ExecProject::nextTuple() {
     Tuple* tuple = child->nextTuple();
     if (!tuple)
         return NULL;
-    lastTuple = make_unique<Tuple>();
-    for (const auto &expr: exprs) {
-        DatumP v = expr->eval(*tuple)->clone();
-        lastTuple->push_back(move(v));
-    }
+    if (commonExprs)
+        commonExprs->nextRows();
+    if (!lastTuple)
+        lastTuple = make_unique<Tuple>();
+    projectInto(exprs, *tuple, *lastTuple);
     return lastTuple.get();
 }
 
+TupleP ExecProject::takeTuple() {
+    Tuple* tuple = child->nextTuple();
+    if (!tuple)
+        return NULL;
+    if (commonExprs)
+        commonExprs->nextRows();
+    return project(*tuple);
+}
+
+/*
+ * Batches of the child are pointers to rows which are already narrowed by
+ * the filters below, and filters only read the columns of their predicates.
+ * So the rest of a row is read here, when it survived, and only the columns
+ * the expressions use. Input rows are never copied, and output tuples are
+ * reused from batch to batch.
+ */
+size_t ExecProject::nextBatch(vector<Tuple *> &batch) {
+    size_t n = child->nextBatch(inputBatch);
+    if (commonExprs)
+        commonExprs->nextRows();
+    batch.clear();
+    if (batchTuples.size() < n)
+        batchTuples.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        if (!batchTuples[i])
+            batchTuples[i] = make_unique<Tuple>();
+        projectInto(exprs, *inputBatch[i], *batchTuples[i]);
+        batch.push_back(batchTuples[i].get());
+    }
+    return n;
+}
+
+TupleP ExecProject::project(const Tuple &tuple) {
+    TupleP result = make_unique<Tuple>();
+    projectInto(exprs, tuple, *result);
+    return result;
+}
+
+void ExecProject::addToPipeline(Pipeline &pipeline) {
+    child->addToPipeline(pipeline);
+    pipeline.addProjection(exprs, commonExprs.get());
+}
+
+void ExecProject::eliminateCommonExprs() {
+    vector<unique_ptr<Expr> *> exprs;
+    for (auto &expr: this->exprs)
+        exprs.push_back(&expr);
+    commonExprs = shareWithFilters(exprs, *child);
+}
+
+void ExecProject::visitExprs(const ExprVisitor &visit) {
+    child->visitExprs(visit);
+    for (auto &expr: exprs)
+        visit(expr);
+}
+
+void ExecProject::projectInto(vector<unique_ptr<Expr>> &exprs,
+                              const Tuple &tuple, Tuple &out)
+{
+    out.resize(exprs.size());
+    for (size_t i = 0; i < exprs.size(); i++)
+        exprs[i]->eval(tuple)->copyTo(out[i]);
+}
+
 /* ExecCount */
 Tuple* ExecCount::nextTuple() {
     if (evaluated)
         return NULL;
-    int count = 0;
-    while (child->nextTuple()) {
-        count++;
+    if (!counted) {
+        while (child->nextTuple()) {
+            count++;
+        }
+        finish();
     }
-    result.push_back(make_unique<IntDatum>(count));
     evaluated = true;
     return &result;
 }
+
+void ExecCount::finish() {
+    result.push_back(make_unique<BigIntDatum>(count));
+    counted = true;
+}
+
+/* ExecLimit */
+Tuple* ExecLimit::nextTuple() {
+    if (!beforeRow())
+        return NULL;
+    Tuple *tuple = child->nextTuple();
+    return afterRow(tuple) ? tuple : NULL;
+}
+
+TupleP ExecLimit::takeTuple() {
+    if (!beforeRow())
+        return NULL;
+    TupleP tuple = child->takeTuple();
+    return afterRow(tuple != NULL) ? move(tuple) : NULL;
+}
+
+size_t ExecLimit::nextBatch(vector<Tuple *> &batch) {
+    batch.clear();
+    while (!done && returned < limit && child->nextBatch(batch)) {
+        size_t skip = min(offset - skipped, batch.size());
+        skipped += skip;
+        size_t n = min(limit - returned, batch.size() - skip);
+        batch.erase(batch.begin(), batch.begin() + skip);
+        batch.resize(n);
+        returned += n;
+        if (n > 0)
+            break;
+    }
+    if (returned == limit || batch.empty())
+        finish();
+    return batch.size();
+}
+
+/* skips the offset rows, returns false if no more rows will be returned */
+bool ExecLimit::beforeRow() {
+    if (done || returned == limit) {
+        finish();
+        return false;
+    }
+    for (; skipped < offset; skipped++) {
+        if (!child->nextTuple()) {
+            finish();
+            return false;
+        }
+    }
+    return true;
+}
+
+/* counts a row read after beforeRow(), returns false at the end of the input */
+bool ExecLimit::afterRow(bool found) {
+    if (!found) {
+        finish();
+        return false;
+    }
+    if (++returned == limit)
+        finish();
+    return true;
+}
+
+/* stops the input once no more rows will be returned, leaving the current ones valid */
+void ExecLimit::finish() {
+    if (!done)
+        child->stop();
+    done = true;
+}
+
+static bool passRowFilters(const vector<shared_ptr<RowFilter>> &filters,
+                           const Tuple &tuple)
+{
+    for (const auto &filter: filters) {
+        if (!filter->pass(tuple))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Shares the common subexpressions of exprs, which a node evaluates on the
+ * rows of child, and of the chain of filters starting at child, which see
+ * the same rows first. The lowest of the filters drops the results when it
+ * reads rows, and if there are no filters, the CommonExprs is returned for
+ * the node to do so. The pass goes on below the filters.
+ */
+static shared_ptr<CommonExprs> shareWithFilters(vector<unique_ptr<Expr> *> exprs,
+                                                ExecNode &child)
+{
+    vector<ExecFilter *> filters;
+    ExecNode *node = &child;
+    while (auto *filter = dynamic_cast<ExecFilter *>(node)) {
+        filters.push_back(filter);
+        exprs.push_back(&filter->getExpr());
+        node = &filter->getChild();
+    }
+    node->eliminateCommonExprs();
+    shared_ptr<CommonExprs> common = shareCommonExprs(exprs);
+    if (common && !filters.empty()) {
+        filters.back()->setCommonExprs(common);
+        return NULL;
+    }
+    return common;
+}
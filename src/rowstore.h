@@ -4,80 +4,271 @@
 #include <schema.h>
 #include <tuple.h>
 #include <expr.h>
+#include <aggfuncs.h>
+#include <pipeline.h>
 #include <memory>
+#include <map>
+#include <atomic>
 
 struct RowStore {
     Schema schema;
     std::vector<Tuple> tuples;
 };
 
+/*
+ * Predicate an operator pushes down into its input, such as the key filter
+ * a join publishes once its build side has been read.
+ */
+class RowFilter {
+public:
+    virtual ~RowFilter() {}
+    virtual bool pass(const Tuple &tuple) = 0;
+};
+
 class ExecNode {
 public:
+    virtual ~ExecNode() {}
     virtual std::vector<TupleP> eval();
+
+    /*
+     * Returns the next tuple, or NULL at the end. The node owns the tuple,
+     * which stays valid until the next call.
+     */
     virtual Tuple* nextTuple() = 0;
+
+    /*
+     * Same as nextTuple(), but hands the tuple over to the caller. Nodes
+     * which build their output tuples, or own them and won't return them
+     * again, move them out. The default implementation clones the tuple
+     * of nextTuple(), which is needed when it belongs to an input or is
+     * kept by the node, as the rows of ExecScan are.
+     */
+    virtual TupleP takeTuple();
+
+    /*
+     * Replaces the contents of batch with up to batchSize tuples, and
+     * returns their count. Returns 0 once the input is exhausted. Tuples
+     * stay valid until the next call. The default implementation copies
+     * the tuples returned by nextTuple(), since a node may reuse its output
+     * tuple between calls.
+     */
+    virtual size_t nextBatch(std::vector<Tuple *> &batch);
+
+    /*
+     * Asks the node to drop tuples which don't pass filter from its output.
+     * Returns false if the node doesn't support row filters.
+     */
+    virtual bool addRowFilter(std::shared_ptr<RowFilter> filter) { return false; }
+
+    /*
+     * Tells the node that no more tuples will be read from it, so it can
+     * stop reading its own inputs. Nodes pass this on to their inputs, and
+     * scans return no more tuples afterwards, which also ends parallel
+     * readers early. Only sets flags, so it may be called from another
+     * thread while the plan runs, e.g. to cancel a query.
+     */
+    virtual void stop() {}
+
+    /*
+     * Planner pass which fuses the chains of non-blocking operators below
+     * the aggregates of the plan into pipelines, see Pipeline. The nodes
+     * stay in the plan, so an unfused plan can still be run for debugging.
+     */
+    virtual void fusePipelines() {}
+
+    /*
+     * Adds the node to a pipeline: operators which can work a row at a
+     * time add their child and then themselves as a stage, and others
+     * become the source, which is read with nextBatch().
+     */
+    virtual void addToPipeline(Pipeline &pipeline) { pipeline.setSource(*this); }
+
+    /*
+     * Translation into push-based pipelines, see PipelineExecutor. Pipeline
+     * breakers add a pipeline from their input into themselves, and other
+     * nodes pass this on to the inputs they pull rows from.
+     */
+    virtual void addPipelines(PipelineExecutor &executor) {}
+
+    /*
+     * Calls visit on each expression of the node and of its inputs, which
+     * may replace it, e.g. with simplifyExpr(). Pipelines point to the
+     * expressions, so this must be done before they are built.
+     */
+    virtual void visitExprs(const ExprVisitor &visit) {}
+
+    /*
+     * Planner pass which shares the subexpressions the expressions of a
+     * projection or an aggregate have in common with each other and with
+     * the chain of filters right below it, since they are all evaluated on
+     * the same rows, see shareCommonExprs(). Like visitExprs(), it must run
+     * before pipelines are built.
+     */
+    virtual void eliminateCommonExprs() {}
+
+    static constexpr size_t batchSize = 1024;
+private:
+    std::vector<TupleP> batchCopies;
 };
 
-class AggFunc {
+/*
+ * Hands out fixed-size blocks for aggregate states. Blocks are carved out
+ * of large chunks, and released blocks are reused by later allocations.
+ */
+class GroupStatePool {
 public:
-    virtual DatumP init() = 0;
-    virtual void aggregate(Datum &state, const Datum &next) = 0;
-    virtual DatumP finalize(Datum &state) = 0;
+    GroupStatePool(): blockSize(0), chunkUsed(blocksPerChunk) {}
+    void setBlockSize(size_t size) { blockSize = size; }
+    char *allocate();
+    void release(char *block) { freeBlocks.push_back(block); }
+
+    static constexpr size_t blocksPerChunk = 256;
+private:
+    size_t blockSize;
+    size_t chunkUsed;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<char *> freeBlocks;
 };
 
-class AggFuncCall{
+/*
+ * Small fixed-size open addressing table which ExecAgg puts in front of its
+ * main group table. Rows with repeating group keys are combined here, and the
+ * whole table is flushed into the main table whenever it fills up.
+ */
+class PreAggTable {
 public:
-    AggFuncCall(std::unique_ptr<AggFunc> func,
-                std::unique_ptr<Expr> expr):
-        func(std::move(func)), expr(std::move(expr)) {}
+    static constexpr size_t capacity = 1024;
+    static constexpr size_t maxEntries = capacity * 3 / 4;
+
+    struct Entry {
+        size_t hash;
+        TupleP key;
+        char *state;
+    };
 
-    DatumP init();
-    void aggregate(Datum &state, const Tuple& next);
-    void addResult(Datum &state, Tuple &tuple);
+    PreAggTable(): entries(capacity), used(0) {}
+
+    /*
+     * Returns the entry for the group of the given tuple. If the group is not
+     * in the table, returns the empty entry where it should be inserted.
+     */
+    Entry &probe(const Tuple &tuple, const std::vector<int> &groupBy, size_t hash);
+    void insert(Entry &entry, size_t hash, TupleP key, char *state);
+    void prefetch(size_t hash) const { __builtin_prefetch(&entries[hash & (capacity - 1)]); }
+    bool full() const { return used >= maxEntries; }
+    size_t size() const { return used; }
+    std::vector<Entry> &getEntries() { return entries; }
+    void clear();
 private:
-    std::unique_ptr<AggFunc> func;
-    std::unique_ptr<Expr> expr;
+    std::vector<Entry> entries;
+    size_t used;
 };
 
-template <class inputType>
-class AggSum: public AggFunc {
-public:
-    DatumP init() override;
-    void aggregate(Datum &state, const Datum &next) override;
-    DatumP finalize(Datum &state) override;
-
-    static std::unique_ptr<AggFuncCall> makeCall(std::unique_ptr<Expr> expr) {
-        return std::make_unique<AggFuncCall>(
-                    std::make_unique<AggSum<inputType>>(),
-                    std::move(expr));
-    }
+enum AggStrategy {
+    /* collect all groups in a table, emit them in group key order at the end */
+    AGG_HASHED,
+    /*
+     * input is ordered on the group by columns, so emit each group as soon
+     * as its key changes. Only the current group's state is kept.
+     */
+    AGG_SORTED
 };
 
-class ExecAgg: public ExecNode {
+class ExecAgg: public ExecNode, public PipelineSink {
 public:
     ExecAgg(std::unique_ptr<ExecNode> child, std::vector<int> groupBy,
-            std::vector<std::unique_ptr<AggFuncCall>> aggs):
-                child(std::move(child)), groupBy(groupBy), aggs(std::move(aggs)) {}
+            std::vector<std::unique_ptr<AggFuncCall>> aggs,
+            AggStrategy strategy = AGG_HASHED);
+    ~ExecAgg();
     std::vector<TupleP> eval() override;
     Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    void stop() override { child->stop(); }
+
+    /*
+     * Reads the input through a fused pipeline, unless the strategy is
+     * AGG_SORTED, whose groups are returned while the input is read.
+     */
+    void fusePipelines() override;
+    void addPipelines(PipelineExecutor &executor) override;
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override;
+    void consume(Tuple *const *rows, size_t n) override;
+    void finish() override;
+
+    /* false once pre-aggregation has backed off because keys are near-unique */
+    bool preAggregating() const { return preAggEnabled; }
+
+    /*
+     * Pre-aggregation is turned off when a flush shows that fewer than this
+     * fraction of the rows were combined with an earlier row of their group.
+     */
+    static constexpr double minPreAggReduction = 0.25;
 private:
+    /* groups by normalized key, so key lookups compare with memcmp() */
+    struct Group {
+        TupleP key;
+        char *state;
+    };
+    typedef std::map<std::string, Group> GroupMap;
+
     std::unique_ptr<ExecNode> child;
     std::vector<int> groupBy;
     std::vector<std::unique_ptr<AggFuncCall>> aggs;
+    AggStrategy strategy;
+    /* each group's aggregate states are stored in one block of the pool */
+    std::vector<size_t> stateOffsets;
+    GroupStatePool statePool;
     std::vector<TupleP> tuples;
     bool tuplesCalculated = false;
     int nextTupleIndex = 0;
+    std::unique_ptr<Pipeline> pipeline;
+    /* common subexpressions whose results are dropped on new input, see CommonExprs */
+    std::shared_ptr<CommonExprs> commonExprs;
+
+    /* state of AGG_HASHED */
+    GroupMap groups;
+    char *singleState = NULL;
+    std::vector<char *> states;
+
+    /* state of AGG_SORTED */
+    TupleP currentKey;
+    char *currentState = NULL;
+    TupleP lastResult;
+    bool inputDone = false;
+
+    PreAggTable preAgg;
+    bool preAggEnabled = true;
+    size_t preAggRows = 0;
+    /* group key hashes of the current batch */
+    std::vector<size_t> batchHashes;
+    std::string normalizedKey;
 
     TupleP getGroupKey(const Tuple &tuple);
-    std::vector<TupleP> evalSingleGroup();
+    char *initGroupState();
+    void destroyGroupState(char *state);
+    char *findOrCreateGroup(const Tuple &tuple);
+    char *preAggregate(const Tuple &tuple, size_t hash);
+    void flushPreAgg();
+    void aggregateBatch(char *const *states, Tuple *const *rows, size_t n);
+    std::vector<TupleP> finishGroups();
+    Tuple *nextSortedGroup();
+    bool sameGroup(const Tuple &key, const Tuple &tuple);
+    TupleP finalizeGroup(TupleP key, const char *state);
 };
 
 class ExecScan: public ExecNode {
 public:
     ExecScan(std::vector<TupleP> tuples): tuples(std::move(tuples)) {}
     Tuple* nextTuple() override;
+    size_t nextBatch(std::vector<Tuple *> &batch) override;
+    bool addRowFilter(std::shared_ptr<RowFilter> filter) override;
+    void stop() override { stopped = true; }
 private:
     std::vector<TupleP> tuples;
     int nextTupleIndex = 0;
+    std::atomic<bool> stopped { false };
+    std::vector<std::shared_ptr<RowFilter>> rowFilters;
 };
 
 class ExecFilter: public ExecNode {
@@ -86,9 +277,25 @@ public:
                std::unique_ptr<Expr> expr):
                     child(std::move(child)), expr(std::move(expr)) {}
     Tuple* nextTuple() override;
+    size_t nextBatch(std::vector<Tuple *> &batch) override;
+    bool addRowFilter(std::shared_ptr<RowFilter> filter) override;
+    void stop() override { child->stop(); }
+    void fusePipelines() override { child->fusePipelines(); }
+    void addToPipeline(Pipeline &pipeline) override;
+    void addPipelines(PipelineExecutor &executor) override { child->addPipelines(executor); }
+    void visitExprs(const ExprVisitor &visit) override { child->visitExprs(visit); visit(expr); }
+    void eliminateCommonExprs() override;
+
+    ExecNode &getChild() { return *child; }
+    std::unique_ptr<Expr> &getExpr() { return expr; }
+
+    /* sets the common subexpressions whose results are dropped when rows are read */
+    void setCommonExprs(std::shared_ptr<CommonExprs> common) { commonExprs = std::move(common); }
 private:
     std::unique_ptr<ExecNode> child;
     std::unique_ptr<Expr> expr;
+    std::vector<std::shared_ptr<RowFilter>> rowFilters;
+    std::shared_ptr<CommonExprs> commonExprs;
 };
 
 class ExecProject: public ExecNode {
@@ -97,20 +304,75 @@ public:
                 std::vector<std::unique_ptr<Expr>> exprs):
                     child(std::move(child)), exprs(std::move(exprs)) {}
     Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    size_t nextBatch(std::vector<Tuple *> &batch) override;
+    void stop() override { child->stop(); }
+    void fusePipelines() override { child->fusePipelines(); }
+    void addToPipeline(Pipeline &pipeline) override;
+    void addPipelines(PipelineExecutor &executor) override { child->addPipelines(executor); }
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override;
+
+    /* overwrites the values of out, so a tuple projected into before doesn't allocate */
+    static void projectInto(std::vector<std::unique_ptr<Expr>> &exprs,
+                            const Tuple &tuple, Tuple &out);
 private:
     std::unique_ptr<ExecNode> child;
     std::vector<std::unique_ptr<Expr>> exprs;
+    std::shared_ptr<CommonExprs> commonExprs;
     TupleP lastTuple;
+    std::vector<Tuple *> inputBatch;
+    std::vector<TupleP> batchTuples;
+
+    TupleP project(const Tuple &tuple);
 };
 
-class ExecCount: public ExecNode {
+class ExecCount: public ExecNode, public PipelineSink {
 public:
     ExecCount(std::unique_ptr<ExecNode> child): child(std::move(child)) {}
     Tuple* nextTuple() override;
+    void stop() override { child->stop(); }
+    void fusePipelines() override { child->fusePipelines(); }
+    void addPipelines(PipelineExecutor &executor) override { executor.addPipeline(*child, *this); }
+    void visitExprs(const ExprVisitor &visit) override { child->visitExprs(visit); }
+    void eliminateCommonExprs() override { child->eliminateCommonExprs(); }
+    void consume(Tuple *const *rows, size_t n) override { count += n; }
+    void finish() override;
 private:
     std::unique_ptr<ExecNode> child;
     Tuple result;
+    long long count = 0;
+    bool counted = false;
     bool evaluated = false;
 };
 
+/*
+ * LIMIT limit OFFSET offset. The input is stopped as soon as the last row
+ * has been returned, so nodes below don't produce rows nobody will read.
+ */
+class ExecLimit: public ExecNode {
+public:
+    ExecLimit(std::unique_ptr<ExecNode> child, size_t limit, size_t offset = 0):
+        child(std::move(child)), limit(limit), offset(offset) {}
+    Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    size_t nextBatch(std::vector<Tuple *> &batch) override;
+    void stop() override { child->stop(); }
+    void fusePipelines() override { child->fusePipelines(); }
+    void addPipelines(PipelineExecutor &executor) override { child->addPipelines(executor); }
+    void visitExprs(const ExprVisitor &visit) override { child->visitExprs(visit); }
+    void eliminateCommonExprs() override { child->eliminateCommonExprs(); }
+private:
+    std::unique_ptr<ExecNode> child;
+    size_t limit;
+    size_t offset;
+    size_t skipped = 0;
+    size_t returned = 0;
+    bool done = false;
+
+    bool beforeRow();
+    bool afterRow(bool found);
+    void finish();
+};
+
 #endif
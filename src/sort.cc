@@ -0,0 +1,541 @@
+#include <sort.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <functional>
+using namespace std;
+
+static FILE *createTempFile();
+static size_t entryMemoryUsage(const SortEntry &entry);
+static bool radixSortEntries(vector<SortEntry> &entries);
+static void sampleSortEntries(vector<SortEntry> &entries, size_t threads);
+static void runWorkers(size_t threads, const function<void()> &worker);
+static void normalizeSortKey(vector<SortKey> &keys, const Tuple &tuple, string &out);
+
+void sortEntries(vector<SortEntry> &entries, size_t threads) {
+    if (threads == 0)
+        threads = max(thread::hardware_concurrency(), 1u);
+    if (entries.size() < 2 || radixSortEntries(entries))
+        return;
+    if (threads > 1 && entries.size() >= parallelSortRows) {
+        sampleSortEntries(entries, threads);
+        return;
+    }
+    stable_sort(entries.begin(), entries.end(),
+                [](const SortEntry &a, const SortEntry &b) {
+                    return a.key < b.key;
+                });
+}
+
+void sortTable(vector<TupleP> &rows, vector<SortKey> &keys, size_t threads) {
+    vector<SortEntry> entries(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+        normalizeSortKey(keys, *rows[i], entries[i].key);
+        entries[i].row = move(rows[i]);
+    }
+    sortEntries(entries, threads);
+    for (size_t i = 0; i < rows.size(); i++)
+        rows[i] = move(entries[i].row);
+}
+
+/* RunMerger */
+RunMerger::RunMerger(vector<FILE *> runs):
+    runs(move(runs)), heads(this->runs.size()), exhausted(this->runs.size())
+{
+}
+
+RunMerger::~RunMerger() {
+    for (FILE *run: runs)
+        fclose(run);
+}
+
+SortEntry *RunMerger::next() {
+    size_t k = runs.size();
+    if (!started) {
+        for (size_t i = 0; i < k; i++)
+            exhausted[i] = !readEntry(runs[i], heads[i]);
+        tree.assign(k, 0);
+        tree[0] = initTree(1);
+        started = true;
+    } else {
+        /* refill the run of the last winner, and replay its path to the root */
+        size_t winner = tree[0];
+        exhausted[winner] = !readEntry(runs[winner], heads[winner]);
+        for (size_t node = (winner + k) / 2; node > 0; node /= 2) {
+            if (beats(tree[node], winner))
+                swap(tree[node], winner);
+        }
+        tree[0] = winner;
+    }
+    if (exhausted[tree[0]])
+        return NULL;
+    current = move(heads[tree[0]]);
+    return &current;
+}
+
+/*
+ * Plays the matches of the subtree at node, whose leaves k..2k-1 stand for
+ * the runs, and returns the winner.
+ */
+size_t RunMerger::initTree(size_t node) {
+    size_t k = runs.size();
+    if (node >= k)
+        return node - k;
+    size_t a = initTree(2 * node);
+    size_t b = initTree(2 * node + 1);
+    if (beats(a, b)) {
+        tree[node] = b;
+        return a;
+    }
+    tree[node] = a;
+    return b;
+}
+
+/* true if the head of run a comes before the head of run b */
+bool RunMerger::beats(size_t a, size_t b) const {
+    if (exhausted[a] || exhausted[b])
+        return !exhausted[a];
+    int cmp = heads[a].key.compare(heads[b].key);
+    if (cmp != 0)
+        return cmp < 0;
+    return a < b;
+}
+
+/* entries are stored as their size, followed by the key and the row */
+void RunMerger::writeEntry(FILE *file, const SortEntry &entry) {
+    string out;
+    writeValue(out, (uint32_t) 0);
+    writeValue(out, entry.key);
+    writeTuple(out, *entry.row);
+    uint32_t size = out.size() - sizeof(uint32_t);
+    memcpy(&out[0], &size, sizeof(size));
+    if (fwrite(out.data(), 1, out.size(), file) != out.size())
+        throw runtime_error("cannot write sort run");
+}
+
+bool RunMerger::readEntry(FILE *file, SortEntry &entry) {
+    uint32_t size;
+    if (fread(&size, sizeof(size), 1, file) != 1)
+        return false;
+    string data(size, '\0');
+    if (fread(&data[0], 1, size, file) != size)
+        throw runtime_error("cannot read sort run");
+    const char *pos = data.data();
+    uint32_t keySize;
+    memcpy(&keySize, pos, sizeof(keySize));
+    pos += sizeof(keySize);
+    entry.key.assign(pos, keySize);
+    pos += keySize;
+    entry.row = readTuple(pos);
+    return true;
+}
+
+/* ExecSort */
+ExecSort::ExecSort(unique_ptr<ExecNode> child, vector<SortKey> keys,
+                   size_t memoryBudget, size_t threads):
+    child(move(child)), memoryBudget(memoryBudget), threads(threads)
+{
+    for (SortKey &key: keys) {
+        keyExprs.push_back(move(key.expr));
+        descending.push_back(key.descending);
+    }
+}
+
+ExecSort::~ExecSort() {
+    for (FILE *run: runs)
+        fclose(run);
+}
+
+Tuple* ExecSort::nextTuple() {
+    if (!sorted)
+        sortInput();
+    if (merger) {
+        SortEntry *entry = merger->next();
+        return entry ? entry->row.get() : NULL;
+    }
+    if (nextEntry < entries.size())
+        return entries[nextEntry++].row.get();
+    return NULL;
+}
+
+/* rows are owned by the sorted entries or by the merger, and never returned twice */
+TupleP ExecSort::takeTuple() {
+    if (!sorted)
+        sortInput();
+    if (merger) {
+        SortEntry *entry = merger->next();
+        return entry ? move(entry->row) : NULL;
+    }
+    if (nextEntry < entries.size())
+        return move(entries[nextEntry++].row);
+    return NULL;
+}
+
+void ExecSort::sortInput() {
+    TupleP tuple;
+    while ((tuple = child->takeTuple())) {
+        SortEntry entry;
+        normalizeSortKey(*tuple, entry.key);
+        entry.row = move(tuple);
+        addEntry(move(entry));
+    }
+    finish();
+}
+
+void ExecSort::consume(Tuple *const *rows, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        SortEntry entry;
+        normalizeSortKey(*rows[i], entry.key);
+        entry.row = cloneTuple(*rows[i]);
+        addEntry(move(entry));
+    }
+}
+
+void ExecSort::addEntry(SortEntry entry) {
+    runMemory += entryMemoryUsage(entry);
+    entries.push_back(move(entry));
+    if (runMemory > memoryBudget) {
+        spillRun();
+        runMemory = 0;
+    }
+}
+
+/* sorts the entries read, or merges the runs if some have been spilled */
+void ExecSort::finish() {
+    if (runs.empty()) {
+        sortEntries(entries, threads);
+    } else {
+        if (!entries.empty())
+            spillRun();
+        while (runs.size() > maxMergeWidth)
+            mergeRuns();
+        merger = make_unique<RunMerger>(move(runs));
+        runs.clear();
+    }
+    sorted = true;
+}
+
+void ExecSort::visitExprs(const ExprVisitor &visit) {
+    child->visitExprs(visit);
+    for (auto &expr: keyExprs)
+        visit(expr);
+}
+
+void ExecSort::normalizeSortKey(const Tuple &tuple, string &out) {
+    out.clear();
+    for (size_t i = 0; i < keyExprs.size(); i++)
+        normalizeDatum(out, *keyExprs[i]->eval(tuple), descending[i]);
+}
+
+/* sorts the entries in memory, and moves them to a new run */
+void ExecSort::spillRun() {
+    sortEntries(entries, threads);
+    FILE *run = createTempFile();
+    for (const SortEntry &entry: entries)
+        RunMerger::writeEntry(run, entry);
+    rewind(run);
+    runs.push_back(run);
+    spillCount++;
+    entries.clear();
+    entries.shrink_to_fit();
+}
+
+/*
+ * Merges each group of maxMergeWidth consecutive runs into a single run.
+ * Groups stay in input order, so the sort remains stable.
+ */
+void ExecSort::mergeRuns() {
+    vector<FILE *> merged;
+    for (size_t i = 0; i < runs.size(); i += maxMergeWidth) {
+        size_t end = min(i + maxMergeWidth, runs.size());
+        if (end - i == 1) {
+            merged.push_back(runs[i]);
+            continue;
+        }
+        RunMerger groupMerger(vector<FILE *>(runs.begin() + i, runs.begin() + end));
+        FILE *run = createTempFile();
+        SortEntry *entry;
+        while ((entry = groupMerger.next()))
+            RunMerger::writeEntry(run, *entry);
+        rewind(run);
+        merged.push_back(run);
+        spillCount++;
+    }
+    runs = move(merged);
+}
+
+/* TopNHeap */
+bool TopNHeap::accepts(const string &key, uint64_t order) const {
+    if (items.size() < limit)
+        return true;
+    if (limit == 0)
+        return false;
+    int cmp = key.compare(items.front().key);
+    return cmp < 0 || (cmp == 0 && order < items.front().order);
+}
+
+void TopNHeap::push(string key, uint64_t order, const Tuple &row) {
+    if (items.size() == limit) {
+        pop_heap(items.begin(), items.end(), itemLess);
+        items.pop_back();
+    }
+    items.push_back(Item { move(key), order, cloneTuple(row) });
+    push_heap(items.begin(), items.end(), itemLess);
+}
+
+void TopNHeap::merge(TopNHeap &other) {
+    for (Item &item: other.items) {
+        if (!accepts(item.key, item.order))
+            continue;
+        if (items.size() == limit) {
+            pop_heap(items.begin(), items.end(), itemLess);
+            items.pop_back();
+        }
+        items.push_back(move(item));
+        push_heap(items.begin(), items.end(), itemLess);
+    }
+    other.items.clear();
+}
+
+vector<TopNHeap::Item> TopNHeap::takeSorted() {
+    sort_heap(items.begin(), items.end(), itemLess);
+    return move(items);
+}
+
+bool TopNHeap::itemLess(const Item &a, const Item &b) {
+    int cmp = a.key.compare(b.key);
+    return cmp < 0 || (cmp == 0 && a.order < b.order);
+}
+
+/* ExecTopN */
+ExecTopN::ExecTopN(unique_ptr<ExecNode> child, vector<SortKey> keys, size_t limit):
+    limit(limit)
+{
+    inputs.push_back(move(child));
+    inputKeys.push_back(move(keys));
+}
+
+ExecTopN::ExecTopN(vector<unique_ptr<ExecNode>> inputs,
+                   vector<vector<SortKey>> inputKeys, size_t limit):
+    inputs(move(inputs)), inputKeys(move(inputKeys)), limit(limit)
+{
+    if (this->inputs.size() != this->inputKeys.size())
+        throw invalid_argument("ExecTopN needs sort keys for each input");
+}
+
+Tuple* ExecTopN::nextTuple() {
+    if (!evaluated) {
+        vector<TopNHeap> heaps;
+        for (size_t i = 0; i < inputs.size(); i++)
+            heaps.emplace_back(limit);
+        atomic<size_t> nextInput(0);
+        runWorkers(inputs.size(), [&]() {
+            size_t input;
+            while ((input = nextInput++) < inputs.size())
+                readInput(input, heaps[input]);
+        });
+        for (size_t i = 1; i < heaps.size(); i++)
+            heaps[0].merge(heaps[i]);
+        if (!heaps.empty())
+            result = heaps[0].takeSorted();
+        evaluated = true;
+    }
+    if (nextResult < result.size())
+        return result[nextResult++].row.get();
+    return NULL;
+}
+
+TupleP ExecTopN::takeTuple() {
+    return nextTuple() ? move(result[nextResult - 1].row) : NULL;
+}
+
+void ExecTopN::stop() {
+    for (auto &input: inputs)
+        input->stop();
+}
+
+void ExecTopN::fusePipelines() {
+    for (auto &input: inputs)
+        input->fusePipelines();
+}
+
+void ExecTopN::addPipelines(PipelineExecutor &executor) {
+    for (auto &input: inputs)
+        input->addPipelines(executor);
+}
+
+void ExecTopN::eliminateCommonExprs() {
+    for (auto &input: inputs)
+        input->eliminateCommonExprs();
+}
+
+void ExecTopN::visitExprs(const ExprVisitor &visit) {
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i]->visitExprs(visit);
+        for (SortKey &key: inputKeys[i])
+            visit(key.expr);
+    }
+}
+
+/* rows of an input are ordered after those of earlier inputs on equal keys */
+void ExecTopN::readInput(size_t input, TopNHeap &heap) {
+    uint64_t order = (uint64_t) input << 40;
+    string key;
+    Tuple *tuple;
+    while ((tuple = inputs[input]->nextTuple())) {
+        normalizeSortKey(inputKeys[input], *tuple, key);
+        if (heap.accepts(key, order))
+            heap.push(key, order, *tuple);
+        order++;
+    }
+}
+
+static void normalizeSortKey(vector<SortKey> &keys, const Tuple &tuple, string &out) {
+    out.clear();
+    for (SortKey &key: keys)
+        normalizeDatum(out, *key.expr->eval(tuple), key.descending);
+}
+
+/* anonymous temporary file, which is deleted when it's closed */
+static FILE *createTempFile() {
+    FILE *file = tmpfile();
+    if (!file)
+        throw runtime_error("cannot create temporary file for sort run");
+    return file;
+}
+
+static size_t entryMemoryUsage(const SortEntry &entry) {
+    return sizeof(SortEntry) + entry.key.capacity() + tupleMemoryUsage(*entry.row);
+}
+
+/*
+ * Radix sorts the entries if their keys have the same length and differ
+ * in at most 8 byte positions. Returns false, leaving the entries alone,
+ * otherwise.
+ */
+static bool radixSortEntries(vector<SortEntry> &entries) {
+    if (entries.size() > UINT32_MAX)
+        return false;
+    const string &first = entries[0].key;
+    size_t width = first.size();
+    vector<char> varies(width, false);
+    for (const SortEntry &entry: entries) {
+        if (entry.key.size() != width)
+            return false;
+        for (size_t i = 0; i < width; i++)
+            varies[i] |= (entry.key[i] != first[i]);
+    }
+    vector<size_t> positions;
+    for (size_t i = 0; i < width; i++) {
+        if (varies[i])
+            positions.push_back(i);
+    }
+    if (positions.size() > 8)
+        return false;
+
+    struct Item {
+        uint64_t key;
+        uint32_t entry;
+    };
+    size_t n = entries.size();
+    vector<Item> items(n), scratch(n);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = 0;
+        for (size_t pos: positions)
+            key = (key << 8) | (unsigned char) entries[i].key[pos];
+        items[i] = Item { key, (uint32_t) i };
+    }
+
+    /* one stable counting sort pass per byte, least significant first */
+    for (size_t pass = 0; pass < positions.size(); pass++) {
+        int shift = 8 * pass;
+        size_t counts[256] = {};
+        for (const Item &item: items)
+            counts[(item.key >> shift) & 0xff]++;
+        size_t offset = 0;
+        for (size_t &count: counts) {
+            size_t c = count;
+            count = offset;
+            offset += c;
+        }
+        for (const Item &item: items)
+            scratch[counts[(item.key >> shift) & 0xff]++] = item;
+        items.swap(scratch);
+    }
+
+    vector<SortEntry> sorted(n);
+    for (size_t i = 0; i < n; i++)
+        sorted[i] = move(entries[items[i].entry]);
+    entries = move(sorted);
+    return true;
+}
+
+/*
+ * Splits the entries into one bucket per thread by splitters taken from a
+ * sorted sample, so that buckets hold similar numbers of entries, and then
+ * sorts the buckets in parallel. Entries keep their input order within a
+ * bucket, and equal keys go to the same bucket, so the sort is stable.
+ */
+static void sampleSortEntries(vector<SortEntry> &entries, size_t threads) {
+    const size_t oversampling = 32;
+    size_t n = entries.size();
+    size_t bucketCount = threads;
+    vector<string> sample;
+    for (size_t i = 0; i < bucketCount * oversampling; i++)
+        sample.push_back(entries[i * n / (bucketCount * oversampling)].key);
+    sort(sample.begin(), sample.end());
+    vector<string> splitters;
+    for (size_t i = 1; i < bucketCount; i++)
+        splitters.push_back(sample[i * oversampling]);
+
+    /* bucket of each entry, computed by the threads over chunks of the entries */
+    vector<uint32_t> bucketOf(n);
+    atomic<size_t> nextChunk(0);
+    const size_t chunkSize = 4096;
+    runWorkers(threads, [&]() {
+        size_t start;
+        while ((start = (nextChunk++) * chunkSize) < n) {
+            for (size_t i = start; i < min(start + chunkSize, n); i++) {
+                bucketOf[i] = upper_bound(splitters.begin(), splitters.end(),
+                                          entries[i].key) - splitters.begin();
+            }
+        }
+    });
+
+    vector<size_t> bounds(bucketCount + 1, 0);
+    for (uint32_t bucket: bucketOf)
+        bounds[bucket + 1]++;
+    for (size_t b = 0; b < bucketCount; b++)
+        bounds[b + 1] += bounds[b];
+    vector<size_t> fill(bounds.begin(), bounds.end() - 1);
+    vector<SortEntry> scattered(n);
+    for (size_t i = 0; i < n; i++)
+        scattered[fill[bucketOf[i]]++] = move(entries[i]);
+    entries = move(scattered);
+
+    atomic<size_t> nextBucket(0);
+    runWorkers(threads, [&]() {
+        size_t b;
+        while ((b = nextBucket++) < bucketCount) {
+            stable_sort(entries.begin() + bounds[b], entries.begin() + bounds[b + 1],
+                        [](const SortEntry &x, const SortEntry &y) {
+                            return x.key < y.key;
+                        });
+        }
+    });
+}
+
+/* runs worker on the calling thread and threads - 1 more, and waits for all of them */
+static void runWorkers(size_t threads, const function<void()> &worker) {
+    vector<thread> workers;
+    for (size_t i = 1; i < threads; i++)
+        workers.emplace_back(worker);
+    worker();
+    for (thread &t: workers)
+        t.join();
+}
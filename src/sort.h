@@ -0,0 +1,187 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <tuple.h>
+#include <expr.h>
+#include <rowstore.h>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+struct SortKey {
+    std::unique_ptr<Expr> expr;
+    /* NULLs sort first in ascending order, and last in descending order */
+    bool descending = false;
+};
+
+/* a row together with its normalized sort key, so entries compare with memcmp() */
+struct SortEntry {
+    std::string key;
+    TupleP row;
+};
+
+/*
+ * Sorts entries on their keys, stably. If the keys have the same length
+ * and differ in at most 8 byte positions, which is the case for integer
+ * and date keys, those bytes are packed with the entry number into a pair
+ * which is LSD radix sorted. Otherwise large inputs are sample sorted by
+ * up to threads threads, 0 meaning one per core, and small ones are sorted
+ * with std::stable_sort.
+ */
+void sortEntries(std::vector<SortEntry> &entries, size_t threads = 0);
+
+/* sorts the rows of a table on the given keys, e.g. to cluster it */
+void sortTable(std::vector<TupleP> &rows, std::vector<SortKey> &keys, size_t threads = 0);
+
+/* entries from which sortEntries() sorts in parallel */
+constexpr size_t parallelSortRows = 1 << 16;
+
+/*
+ * Merges sorted runs of SortEntries stored in files with a loser tree. The
+ * tree keeps the loser of each match between runs in its internal nodes,
+ * so replacing the smallest entry takes one comparison per level. Entries
+ * with equal keys come out in the order of their runs.
+ */
+class RunMerger {
+public:
+    /* takes ownership of the runs, which are closed when the merger is destroyed */
+    RunMerger(std::vector<FILE *> runs);
+    ~RunMerger();
+
+    /* the next entry in key order, valid until the next call, or NULL at the end */
+    SortEntry *next();
+
+    static void writeEntry(FILE *file, const SortEntry &entry);
+    static bool readEntry(FILE *file, SortEntry &entry);
+private:
+    std::vector<FILE *> runs;
+    std::vector<SortEntry> heads;
+    std::vector<bool> exhausted;
+    /* tree[0] is the run with the smallest head, tree[1..] the loser of each match */
+    std::vector<size_t> tree;
+    SortEntry current;
+    bool started = false;
+
+    size_t initTree(size_t node);
+    bool beats(size_t a, size_t b) const;
+};
+
+/*
+ * Sorts its input on the given keys. The sort is stable, so rows with equal
+ * keys keep their input order. Rows are sorted in memory if they fit in
+ * memoryBudget bytes. Otherwise sorted runs of about memoryBudget bytes are
+ * spilled to temporary files, and merged at most maxMergeWidth at a time.
+ */
+class ExecSort: public ExecNode, public PipelineSink {
+public:
+    ExecSort(std::unique_ptr<ExecNode> child, std::vector<SortKey> keys,
+             size_t memoryBudget = defaultMemoryBudget, size_t threads = 0);
+    ~ExecSort();
+    Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    void stop() override { child->stop(); }
+    void fusePipelines() override { child->fusePipelines(); }
+    void addPipelines(PipelineExecutor &executor) override { executor.addPipeline(*child, *this); }
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override { child->eliminateCommonExprs(); }
+    void consume(Tuple *const *rows, size_t n) override;
+    void finish() override;
+
+    /* number of runs written to temporary files, including intermediate merges */
+    size_t spilledRuns() const { return spillCount; }
+
+    static constexpr size_t defaultMemoryBudget = 256 << 20;
+    static constexpr size_t maxMergeWidth = 64;
+private:
+    std::unique_ptr<ExecNode> child;
+    std::vector<std::unique_ptr<Expr>> keyExprs;
+    std::vector<bool> descending;
+    size_t memoryBudget;
+    size_t threads;
+
+    bool sorted = false;
+    std::vector<SortEntry> entries;
+    size_t nextEntry = 0;
+    std::vector<FILE *> runs;
+    size_t spillCount = 0;
+    std::unique_ptr<RunMerger> merger;
+    /* memory used by the entries of the current run */
+    size_t runMemory = 0;
+
+    void sortInput();
+    void addEntry(SortEntry entry);
+    void normalizeSortKey(const Tuple &tuple, std::string &out);
+    void spillRun();
+    void mergeRuns();
+};
+
+/*
+ * The limit smallest of the rows pushed into it, in O(limit) memory. Rows
+ * are kept in a max-heap on (key, order), so the largest kept row is at the
+ * top, and a row which doesn't sort before it is dropped without being
+ * copied. Ties are broken by order, which callers increase with each row.
+ */
+class TopNHeap {
+public:
+    struct Item {
+        std::string key;
+        uint64_t order;
+        TupleP row;
+    };
+
+    TopNHeap(size_t limit): limit(limit) {}
+
+    /* true if a row with this key and order would be kept */
+    bool accepts(const std::string &key, uint64_t order) const;
+
+    /* adds the row, which accepts() must have returned true for */
+    void push(std::string key, uint64_t order, const Tuple &row);
+
+    /* moves the rows of other into this heap, keeping the limit smallest */
+    void merge(TopNHeap &other);
+
+    /* the kept rows in ascending order, which empties the heap */
+    std::vector<Item> takeSorted();
+
+    size_t size() const { return items.size(); }
+private:
+    size_t limit;
+    std::vector<Item> items;
+
+    static bool itemLess(const Item &a, const Item &b);
+};
+
+/*
+ * ORDER BY keys LIMIT limit. Only the limit smallest rows seen so far are
+ * kept, so memory is O(limit) whatever the input size. The node can read
+ * several inputs in parallel, one thread each. Each thread keeps its own
+ * TopNHeap, and the heaps are merged at the end. Every input has its own
+ * copy of the sort keys, since expressions can't be shared between threads.
+ * Rows with equal keys come out in input order, rows of earlier inputs
+ * first.
+ */
+class ExecTopN: public ExecNode {
+public:
+    ExecTopN(std::unique_ptr<ExecNode> child, std::vector<SortKey> keys, size_t limit);
+    ExecTopN(std::vector<std::unique_ptr<ExecNode>> inputs,
+             std::vector<std::vector<SortKey>> inputKeys, size_t limit);
+    Tuple* nextTuple() override;
+    TupleP takeTuple() override;
+    void stop() override;
+    void fusePipelines() override;
+    void addPipelines(PipelineExecutor &executor) override;
+    void visitExprs(const ExprVisitor &visit) override;
+    void eliminateCommonExprs() override;
+private:
+    std::vector<std::unique_ptr<ExecNode>> inputs;
+    std::vector<std::vector<SortKey>> inputKeys;
+    size_t limit;
+
+    bool evaluated = false;
+    std::vector<TopNHeap::Item> result;
+    size_t nextResult = 0;
+
+    void readInput(size_t input, TopNHeap &heap);
+};
+
+#endif
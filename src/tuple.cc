@@ -9,6 +9,9 @@ static vector<string> tokenize(const string &s, char delimiter);
 static DatumP datumFromString(const string &s, ColumnType type);
 static bool boolFromString(const string &s);
 static Date dateFromString(const string &s);
+static DatumP readDatum(const char *&pos);
+template <class T> static T readValue(const char *&pos);
+template <> string readValue<string>(const char *&pos);
 
 string tupleToString(const Tuple& tuple, char delimiter) {
     string result;
@@ -51,6 +54,62 @@ TupleP cloneTuple(const Tuple &tuple) {
     return result;
 }
 
+void writeTuple(string &out, const Tuple &tuple) {
+    writeValue(out, (uint32_t) tuple.size());
+    for (const DatumP &datum: tuple)
+        datum->write(out);
+}
+
+TupleP readTuple(const char *&pos) {
+    uint32_t size = readValue<uint32_t>(pos);
+    TupleP result = make_unique<Tuple>();
+    result->reserve(size);
+    for (uint32_t i = 0; i < size; i++)
+        result->push_back(readDatum(pos));
+    return result;
+}
+
+size_t tupleMemoryUsage(const Tuple &tuple) {
+    size_t result = sizeof(Tuple) + tuple.capacity() * sizeof(DatumP);
+    for (const DatumP &datum: tuple)
+        result += datum->memoryUsage();
+    return result;
+}
+
+void normalizeDatum(string &out, const Datum &value, bool descending) {
+    size_t start = out.size();
+    if (value.isNull()) {
+        out += '\0';
+    } else {
+        out += '\1';
+        value.normalize(out);
+    }
+    if (descending) {
+        for (size_t i = start; i < out.size(); i++)
+            out[i] = ~out[i];
+    }
+}
+
+void normalizeColumns(string &out, const Tuple &tuple, const vector<int> &columns) {
+    out.clear();
+    for (int idx: columns)
+        normalizeDatum(out, *tuple[idx]);
+}
+
+size_t hashTuple(const Tuple &tuple, const vector<int> &columns) {
+    size_t result = 0;
+    for (int idx: columns)
+        result = hashCombine(result, *tuple[idx]);
+    return result;
+}
+
+size_t hashTuple(const Tuple &tuple) {
+    size_t result = 0;
+    for (const DatumP &datum: tuple)
+        result = hashCombine(result, *datum);
+    return result;
+}
+
 static string escapeString(const string &s, char delimiter) {
     string result;
     for (char c: s) {
@@ -115,3 +174,40 @@ static Date dateFromString(const string &s) {
     result.day = atoi(tokens[2].c_str());
     return result;
 }
+
+static DatumP readDatum(const char *&pos) {
+    char tag = *pos++;
+    if (tag == NULL_TAG)
+        return make_unique<NullDatum>();
+    switch ((ColumnType) tag) {
+        case TYPE_TEXT:
+            return makeDatum(readValue<string>(pos));
+        case TYPE_DECIMAL:
+            return makeDatum(readValue<double>(pos));
+        case TYPE_INT:
+            return makeDatum(readValue<int>(pos));
+        case TYPE_BIGINT:
+            return makeDatum(readValue<long long>(pos));
+        case TYPE_DATE:
+            return makeDatum(readValue<Date>(pos));
+        case TYPE_BOOL:
+            return makeDatum(readValue<bool>(pos));
+    }
+    return NULL;
+}
+
+template <class T>
+static T readValue(const char *&pos) {
+    T value;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+template <>
+string readValue<string>(const char *&pos) {
+    uint32_t size = readValue<uint32_t>(pos);
+    string value(pos, size);
+    pos += size;
+    return value;
+}
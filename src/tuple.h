@@ -3,18 +3,59 @@
 
 #include <vector>
 #include <exception>
+#include <stdexcept>
 #include <memory>
 #include <string>
 #include <sstream>
 #include <schema.h>
 #include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <typeinfo>
+
+enum ArithOp {
+    ADD,
+    SUBTRACT,
+    MULTIPLY
+};
 
 class Datum {
 public:
+    virtual ~Datum() {}
     virtual bool operator<(const Datum &other) const = 0;
     virtual std::unique_ptr<Datum> clone() const = 0;
     virtual std::unique_ptr<Datum> multiply(const Datum &other) const = 0;
+
+    /*
+     * Same as out = clone() and out = multiply(other), but the datum in out
+     * is overwritten if it has the type of the result, so that evaluating
+     * into the same slot row after row doesn't allocate.
+     */
+    virtual void copyTo(std::unique_ptr<Datum> &out) const = 0;
+    virtual void multiplyTo(const Datum &other, std::unique_ptr<Datum> &out) const {
+        out = multiply(other);
+    }
+
+    /* out = this op other, with the datum in out overwritten like by multiplyTo() */
+    virtual void arithmeticTo(ArithOp op, const Datum &other, std::unique_ptr<Datum> &out) const {
+        if (op != MULTIPLY)
+            throw std::invalid_argument("arithmetic on a non-numeric value");
+        multiplyTo(other, out);
+    }
+
     virtual std::string toString() const = 0;
+    virtual size_t hash() const = 0;
+    virtual bool isNull() const { return false; }
+
+    /* appends a binary encoding of the datum, which readTuple() decodes */
+    virtual void write(std::string &out) const = 0;
+
+    /* approximate number of bytes of memory held by the datum */
+    virtual size_t memoryUsage() const = 0;
+
+    /* appends the normalized encoding of the value, see normalizeDatum() */
+    virtual void normalize(std::string &out) const = 0;
 
     virtual bool operator==(const Datum &other) const {
         return !(*this < other) && !(other < *this);
@@ -29,20 +70,84 @@ public:
     }
 
     virtual bool operator>(const Datum &other) const {
-        return !(*this < other) && !(*this == other);
+        return other < *this;
     }
 
     virtual bool operator<=(const Datum &other) const {
-        return *this < other || *this == other;
+        return !(other < *this);
     }
 };
 
+/* type tag of NULLs in the binary encoding, other values are tagged with their ColumnType */
+const char NULL_TAG = (char) 0xff;
+
+template <class T>
+inline void writeValue(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+inline void writeValue(std::string &out, const std::string &value) {
+    writeValue(out, (uint32_t) value.size());
+    out.append(value);
+}
+
+/*
+ * Normalized encodings of values, whose memcmp() order is the order of
+ * the values: integers are stored big-endian with the sign bit flipped,
+ * and doubles with the sign bit flipped if positive and all bits flipped
+ * if negative. Strings are terminated by two zero bytes, and zero bytes in
+ * them are followed by 0xff, so no encoding is a prefix of another.
+ */
+inline void appendBigEndian(std::string &out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        out += (char) (value >> (8 * i));
+}
+
+inline void normalizeValue(std::string &out, int value) {
+    appendBigEndian(out, (uint32_t) value ^ 0x80000000u, 4);
+}
+
+inline void normalizeValue(std::string &out, long long value) {
+    appendBigEndian(out, (uint64_t) value ^ (1ULL << 63), 8);
+}
+
+inline void normalizeValue(std::string &out, double value) {
+    /* -0.0 is equal to 0.0 */
+    if (value == 0)
+        value = 0;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = (bits >> 63) ? ~bits : bits | (1ULL << 63);
+    appendBigEndian(out, bits, 8);
+}
+
+inline void normalizeValue(std::string &out, bool value) {
+    out += (char) value;
+}
+
+inline void normalizeValue(std::string &out, const Date &value) {
+    normalizeValue(out, value.year);
+    out += (char) value.month;
+    out += (char) value.day;
+}
+
+inline void normalizeValue(std::string &out, const std::string &value) {
+    for (char c: value) {
+        out += c;
+        if (c == '\0')
+            out += (char) 0xff;
+    }
+    out.append(2, '\0');
+}
+
 template <class T>
 class BoxedDatum: public Datum {
 public:
     T value;
     BoxedDatum(T value): value(value) {}
     virtual bool operator<(const Datum &other) const override {
+        if (other.isNull())
+            return false;
         auto otherBoxed = static_cast<const BoxedDatum<T> *>(&other);
         return value < otherBoxed->value;
     }
@@ -55,6 +160,13 @@ public:
         throw;
     }
 
+    virtual void copyTo(std::unique_ptr<Datum> &out) const override {
+        if (out && typeid(*out) == typeid(*this))
+            static_cast<BoxedDatum<T> &>(*out).value = value;
+        else
+            out = clone();
+    }
+
     virtual std::string toString() const override {
         std::ostringstream sstream;
         sstream << std::fixed << std::showpoint;
@@ -62,6 +174,25 @@ public:
         sstream << value;
         return sstream.str();
     }
+
+    virtual size_t hash() const override {
+        return std::hash<T>()(value);
+    }
+
+    virtual void write(std::string &out) const override {
+        out += (char) getColumnType<T>();
+        writeValue(out, value);
+    }
+
+    virtual size_t memoryUsage() const override {
+        if constexpr (std::is_same<T, std::string>::value)
+            return sizeof(*this) + value.capacity();
+        return sizeof(*this);
+    }
+
+    virtual void normalize(std::string &out) const override {
+        normalizeValue(out, value);
+    }
 };
 
 template <class T>
@@ -74,11 +205,101 @@ public:
     }
 
     virtual std::unique_ptr<Datum> multiply(const Datum &other) const override {
-        auto otherNumeric = static_cast<const NumericDatum<T> &>(other);
+        if (other.isNull())
+            return other.clone();
+        auto &otherNumeric = static_cast<const NumericDatum<T> &>(other);
         return std::make_unique<NumericDatum<T>>(NumericDatum<T>::value * otherNumeric.value);
     }
+
+    virtual void multiplyTo(const Datum &other, std::unique_ptr<Datum> &out) const override {
+        arithmeticTo(MULTIPLY, other, out);
+    }
+
+    virtual void arithmeticTo(ArithOp op, const Datum &other,
+                              std::unique_ptr<Datum> &out) const override;
 };
 
+/* SQL NULL, which sorts before all other values. */
+class NullDatum: public Datum {
+public:
+    virtual bool operator<(const Datum &other) const override {
+        return !other.isNull();
+    }
+
+    virtual std::unique_ptr<Datum> clone() const override {
+        return std::make_unique<NullDatum>();
+    }
+
+    virtual std::unique_ptr<Datum> multiply(const Datum &other) const override {
+        return clone();
+    }
+
+    virtual void copyTo(std::unique_ptr<Datum> &out) const override {
+        if (!out || !out->isNull())
+            out = clone();
+    }
+
+    virtual void multiplyTo(const Datum &other, std::unique_ptr<Datum> &out) const override {
+        copyTo(out);
+    }
+
+    virtual void arithmeticTo(ArithOp op, const Datum &other,
+                              std::unique_ptr<Datum> &out) const override {
+        copyTo(out);
+    }
+
+    virtual std::string toString() const override {
+        return "NULL";
+    }
+
+    virtual size_t hash() const override {
+        return 0;
+    }
+
+    virtual bool isNull() const override {
+        return true;
+    }
+
+    virtual void write(std::string &out) const override {
+        out += NULL_TAG;
+    }
+
+    virtual size_t memoryUsage() const override {
+        return sizeof(*this);
+    }
+
+    virtual void normalize(std::string &out) const override {}
+};
+
+template <class T>
+void NumericDatum<T>::arithmeticTo(ArithOp op, const Datum &other,
+                                   std::unique_ptr<Datum> &out) const
+{
+    if (other.isNull()) {
+        other.copyTo(out);
+        return;
+    }
+    T otherValue = static_cast<const NumericDatum<T> &>(other).value;
+    T result;
+    switch (op) {
+        case ADD:
+            result = this->value + otherValue;
+            break;
+        case SUBTRACT:
+            result = this->value - otherValue;
+            break;
+        case MULTIPLY:
+            result = this->value * otherValue;
+            break;
+        default:
+            throw std::invalid_argument("unknown arithmetic operator");
+    }
+    if (out && typeid(*out) == typeid(NumericDatum<T>))
+        static_cast<NumericDatum<T> &>(*out).value = result;
+    else
+        out = std::make_unique<NumericDatum<T>>(result);
+}
+
 typedef NumericDatum<int> IntDatum;
 typedef NumericDatum<double> DoubleDatum;
 typedef NumericDatum<long long> BigIntDatum;
@@ -89,6 +310,17 @@ typedef std::unique_ptr<Datum> DatumP;
 typedef std::vector<DatumP> Tuple;
 typedef std::unique_ptr<Tuple> TupleP;
 
+/* Datum class which holds values of the given type */
+template <class valueType> struct DatumOf { typedef BoxedDatum<valueType> type; };
+template <> struct DatumOf<int> { typedef IntDatum type; };
+template <> struct DatumOf<double> { typedef DoubleDatum type; };
+template <> struct DatumOf<long long> { typedef BigIntDatum type; };
+
+template <class valueType>
+inline DatumP makeDatum(const valueType &value) {
+    return std::make_unique<typename DatumOf<valueType>::type>(value);
+}
+
 struct compareTupleP {
     bool operator()(const TupleP &a, const TupleP &b) const {
         for (size_t i = 0; i < a->size() && i < b->size(); i++) {
@@ -103,9 +335,30 @@ struct compareTupleP {
     }
 };
 
+inline size_t mixHash(size_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* hash of a list of values is built by adding values one by one to a seed of 0 */
+inline size_t hashCombine(size_t seed, const Datum &datum) {
+    return mixHash(seed ^ datum.hash());
+}
+
+/*
+ * Hash of the given columns of a tuple. Values are mixed, so the low bits
+ * can be used directly to index power of two sized tables.
+ */
+size_t hashTuple(const Tuple &tuple, const std::vector<int> &columns);
+size_t hashTuple(const Tuple &tuple);
+
 template <class valueType>
 inline valueType datumValue(const Datum &d) {
-    auto boxed = static_cast<const BoxedDatum<valueType> &>(d);
+    auto &boxed = static_cast<const BoxedDatum<valueType> &>(d);
     return boxed.value;
 }
 
@@ -120,4 +373,27 @@ std::vector<TupleP> parseTuples(const std::string* data, int row_count,
                                 const Schema &schema, char delimiter=',');
 TupleP cloneTuple(const Tuple &tuple);
 
+/*
+ * Binary encoding of tuples, which keeps values exact, unlike
+ * tupleToString(). readTuple() decodes a tuple at pos and moves pos
+ * past it.
+ */
+void writeTuple(std::string &out, const Tuple &tuple);
+TupleP readTuple(const char *&pos);
+
+/* approximate number of bytes of memory held by the tuple */
+size_t tupleMemoryUsage(const Tuple &tuple);
+
+/*
+ * Appends an encoding of value whose memcmp() order is the order of
+ * Datum::operator<, or the reverse of it if descending is set. NULLs come
+ * first, or last if descending. Encodings of several values concatenate
+ * into a key which sorts by each value in turn, so sort, merge and group
+ * keys can be compared as byte strings.
+ */
+void normalizeDatum(std::string &out, const Datum &value, bool descending = false);
+
+/* replaces out with the ascending normalized key of the given columns */
+void normalizeColumns(std::string &out, const Tuple &tuple, const std::vector<int> &columns);
+
 #endif
@@ -0,0 +1,29 @@
+#ifndef COUNTING_EXPR_H
+#define COUNTING_EXPR_H
+
+#include <expr.h>
+#include <memory>
+#include <string>
+
+/* counts the rows an expression is evaluated on */
+class CountingExpr: public Expr {
+public:
+    CountingExpr(std::unique_ptr<Expr> child, size_t &count):
+        child(std::move(child)), count(count) {}
+    Datum *eval(const Tuple &tuple) override {
+        count++;
+        return child->eval(tuple);
+    }
+
+    /* copies with the same child can be shared */
+    void visitChildren(const ExprVisitor &visit) override { visit(child); }
+    bool writeKey(std::string &out) const override {
+        out += '#';
+        return child->writeKey(out);
+    }
+private:
+    std::unique_ptr<Expr> child;
+    size_t &count;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef INT_TABLES_H
+#define INT_TABLES_H
+
+#include <tuple.h>
+#include <vector>
+#include <string>
+
+/* tables of IntDatums for the tests, defined in test_rowstore.cc */
+TupleP createIntTuple(size_t n, const int* values);
+std::vector<TupleP> createIntTable(size_t rows, size_t cols, const int *values);
+
+/* a table of cols columns, with the values of each row in turn */
+std::vector<TupleP> createIntTable(size_t cols, const std::vector<int> &values);
+
+/* the rows of a table as strings, to compare them with expected ones */
+std::vector<std::string> tableStrings(const std::vector<TupleP> &rows);
+
+#endif
@@ -0,0 +1,107 @@
+#include "catch.hpp"
+#include <aggfuncs.h>
+#include <tuple.h>
+#include <memory>
+#include <climits>
+using namespace std;
+
+static TupleP singleValueTuple(DatumP datum) {
+    TupleP result = make_unique<Tuple>();
+    result->push_back(move(datum));
+    return result;
+}
+
+static DatumP finalizeCall(AggFuncCall &call, const char *state) {
+    Tuple result;
+    call.addResult(state, result);
+    return move(result[0]);
+}
+
+TEST_CASE ( "AggSum", "[aggfuncs]" ) {
+    auto call = AggSum<long long>::makeCall(VarExpr::make(0));
+    vector<char> state(call->stateSize());
+    call->init(state.data());
+    call->aggregate(state.data(), *singleValueTuple(make_unique<BigIntDatum>(LLONG_MAX / 2)));
+    call->aggregate(state.data(), *singleValueTuple(make_unique<BigIntDatum>(12)));
+    call->aggregate(state.data(), *singleValueTuple(make_unique<NullDatum>()));
+    REQUIRE ( datumValue<long long>(*finalizeCall(*call, state.data())) == LLONG_MAX / 2 + 12 );
+}
+
+TEST_CASE ( "AggCount", "[aggfuncs]" ) {
+    auto countStar = AggCount::makeStarCall();
+    auto countExpr = AggCount::makeCall(VarExpr::make(0));
+    vector<char> starState(countStar->stateSize()), exprState(countExpr->stateSize());
+    countStar->init(starState.data());
+    countExpr->init(exprState.data());
+
+    vector<TupleP> rows;
+    rows.push_back(singleValueTuple(make_unique<IntDatum>(1)));
+    rows.push_back(singleValueTuple(make_unique<NullDatum>()));
+    rows.push_back(singleValueTuple(make_unique<IntDatum>(3)));
+    vector<Tuple *> rowPtrs { rows[0].get(), rows[1].get(), rows[2].get() };
+    vector<char *> starStates(3, starState.data()), exprStates(3, exprState.data());
+    countStar->aggregateBatch(starStates.data(), 0, rowPtrs.data(), 3);
+    countExpr->aggregateBatch(exprStates.data(), 0, rowPtrs.data(), 3);
+
+    REQUIRE ( datumValue<long long>(*finalizeCall(*countStar, starState.data())) == 3 );
+    REQUIRE ( datumValue<long long>(*finalizeCall(*countExpr, exprState.data())) == 2 );
+}
+
+TEST_CASE ( "AggMin, AggMax", "[aggfuncs]" ) {
+    auto minCall = AggMin<string>::makeCall(VarExpr::make(0));
+    auto maxCall = AggMax<string>::makeCall(VarExpr::make(0));
+    vector<char> minState(minCall->stateSize()), maxState(maxCall->stateSize());
+    minCall->init(minState.data());
+    maxCall->init(maxState.data());
+
+    /* no input, so the result is NULL */
+    REQUIRE ( finalizeCall(*minCall, minState.data())->isNull() );
+
+    for (string s: {"pear", "apple", "quince", "fig"}) {
+        TupleP tuple = singleValueTuple(make_unique<StringDatum>(s));
+        minCall->aggregate(minState.data(), *tuple);
+        maxCall->aggregate(maxState.data(), *tuple);
+    }
+    REQUIRE ( datumValue<string>(*finalizeCall(*minCall, minState.data())) == "apple" );
+    REQUIRE ( datumValue<string>(*finalizeCall(*maxCall, maxState.data())) == "quince" );
+
+    /* merging partial states */
+    vector<char> otherState(minCall->stateSize());
+    minCall->init(otherState.data());
+    minCall->aggregate(otherState.data(), *singleValueTuple(make_unique<StringDatum>("abc")));
+    minCall->merge(minState.data(), otherState.data());
+    REQUIRE ( datumValue<string>(*finalizeCall(*minCall, minState.data())) == "abc" );
+
+    minCall->destroy(minState.data());
+    minCall->destroy(otherState.data());
+    maxCall->destroy(maxState.data());
+}
+
+TEST_CASE ( "AggAvg", "[aggfuncs]" ) {
+    auto call = AggAvg<int>::makeCall(VarExpr::make(0));
+    vector<char> state(call->stateSize());
+    call->init(state.data());
+    REQUIRE ( finalizeCall(*call, state.data())->isNull() );
+    for (int i = 1; i <= 4; i++)
+        call->aggregate(state.data(), *singleValueTuple(make_unique<IntDatum>(i)));
+    REQUIRE ( datumValue<double>(*finalizeCall(*call, state.data())) == 2.5 );
+}
+
+TEST_CASE ( "AggAvg of a batch of large ints matches the row path", "[aggfuncs]" ) {
+    vector<TupleP> rows;
+    vector<Tuple *> batch;
+    for (int i = 0; i < 1024; i++) {
+        rows.push_back(singleValueTuple(make_unique<IntDatum>(2000000000)));
+        batch.push_back(rows.back().get());
+    }
+    auto call = AggAvg<int>::makeCall(VarExpr::make(0));
+    vector<char> rowState(call->stateSize()), batchState(call->stateSize());
+    call->init(rowState.data());
+    call->init(batchState.data());
+    for (Tuple *row: batch)
+        call->aggregate(rowState.data(), *row);
+    call->aggregateBatch(batchState.data(), batch.data(), batch.size());
+    double expected = datumValue<double>(*finalizeCall(*call, rowState.data()));
+    REQUIRE ( expected == 2000000000.0 );
+    REQUIRE ( datumValue<double>(*finalizeCall(*call, batchState.data())) == expected );
+}
@@ -0,0 +1,23 @@
+#include "catch.hpp"
+#include <bloom.h>
+#include <tuple.h>
+using namespace std;
+
+TEST_CASE ( "BloomFilter has no false negatives and few false positives", "[bloom]" ) {
+    BloomFilter filter(10000);
+    for (size_t i = 0; i < 10000; i++)
+        filter.add(mixHash(i));
+    for (size_t i = 0; i < 10000; i++)
+        REQUIRE ( filter.mayContain(mixHash(i)) );
+
+    size_t falsePositives = 0;
+    for (size_t i = 10000; i < 110000; i++)
+        falsePositives += filter.mayContain(mixHash(i));
+    REQUIRE ( falsePositives < 5000 );
+}
+
+TEST_CASE ( "empty BloomFilter contains nothing", "[bloom]" ) {
+    BloomFilter filter;
+    for (size_t i = 0; i < 1000; i++)
+        REQUIRE ( !filter.mayContain(mixHash(i)) );
+}
@@ -1,8 +1,10 @@
 #include "catch.hpp"
+#include "counting_expr.h"
 #include <expr.h>
 #include <tuple.h>
 #include <memory>
 #include <climits>
+#include <algorithm>
 using namespace std;
 
 TEST_CASE ( "ConstExpr", "[exprs]" ) {
@@ -75,6 +77,39 @@ TEST_CASE ( "MultExpr", "[exprs]" ) {
     REQUIRE ( datumValue<int>(*e2->eval(tuple)) == 1092 );
 }
 
+TEST_CASE ( "MultExpr reuses its result datum", "[exprs]" ) {
+    unique_ptr<Expr> e = MultExpr::make(VarExpr::make(0), VarExpr::make(1));
+    Tuple tuple;
+    tuple.push_back(make_unique<DoubleDatum>(1.5));
+    tuple.push_back(make_unique<DoubleDatum>(2));
+
+    Datum *first = e->eval(tuple);
+    REQUIRE ( datumValue<double>(*first) == 3 );
+    tuple[1] = make_unique<DoubleDatum>(4);
+    REQUIRE ( e->eval(tuple) == first );
+    REQUIRE ( datumValue<double>(*first) == 6 );
+
+    /* NULL results replace the datum, and values replace NULLs again */
+    tuple[1] = make_unique<NullDatum>();
+    REQUIRE ( e->eval(tuple)->isNull() );
+    tuple[1] = make_unique<DoubleDatum>(10);
+    REQUIRE ( datumValue<double>(*e->eval(tuple)) == 15 );
+}
+
+TEST_CASE ( "Datum::copyTo overwrites datums of the same type", "[exprs]" ) {
+    DatumP slot;
+    StringDatum("first").copyTo(slot);
+    Datum *stringSlot = slot.get();
+    StringDatum("second").copyTo(slot);
+    REQUIRE ( slot.get() == stringSlot );
+    REQUIRE ( datumValue<string>(*slot) == "second" );
+
+    IntDatum(5).copyTo(slot);
+    REQUIRE ( datumValue<int>(*slot) == 5 );
+    NullDatum().copyTo(slot);
+    REQUIRE ( slot->isNull() );
+}
+
 TEST_CASE ( "CompareExpr", "[exprs]" ) {
     Tuple tuple;
 
@@ -114,6 +149,80 @@ TEST_CASE ( "CompareExpr", "[exprs]" ) {
     REQUIRE ( datumValue<bool>(*e5->eval(tuple)) == false );
 }
 
+TEST_CASE ( "CompareExpr orders NULL first", "[exprs]" ) {
+    CompareOp ops[] = { LT, LTE, EQ, GTE, GT };
+    /* x op y for x < y, x == y, x > y, x NULL, y NULL, both NULL */
+    bool expected[][6] = {
+        { true, false, false, true, false, false },
+        { true, true, false, true, false, true },
+        { false, true, false, false, false, true },
+        { false, true, true, false, true, true },
+        { false, false, true, false, true, false }
+    };
+    int xs[] = { 1, 2, 3, 0, 2, 0 };
+    int ys[] = { 2, 2, 2, 2, 0, 0 };
+    for (size_t o = 0; o < 5; o++) {
+        unique_ptr<Expr> e = CompareExpr::make(VarExpr::make(0), VarExpr::make(1), ops[o]);
+        for (size_t r = 0; r < 6; r++) {
+            Tuple tuple;
+            if (r == 3 || r == 5)
+                tuple.push_back(make_unique<NullDatum>());
+            else
+                tuple.push_back(make_unique<BigIntDatum>(xs[r]));
+            if (r >= 4)
+                tuple.push_back(make_unique<NullDatum>());
+            else
+                tuple.push_back(make_unique<BigIntDatum>(ys[r]));
+            REQUIRE ( datumValue<bool>(*e->eval(tuple)) == expected[o][r] );
+            REQUIRE ( (*tuple[0] > *tuple[1]) == expected[4][r] );
+            REQUIRE ( (*tuple[0] <= *tuple[1]) == expected[1][r] );
+        }
+    }
+}
+
+/* x op constant on strings, with the rows of a batch of x = "a" .. "e" and NULL */
+static vector<bool> selectedStrings(unique_ptr<Expr> &e) {
+    vector<TupleP> rows;
+    vector<Tuple *> batch;
+    for (const char *value: { "a", "b", "c", "d", "e", "" }) {
+        TupleP tuple = make_unique<Tuple>();
+        if (*value)
+            tuple->push_back(make_unique<StringDatum>(value));
+        else
+            tuple->push_back(make_unique<NullDatum>());
+        batch.push_back(tuple.get());
+        rows.push_back(move(tuple));
+    }
+    vector<bool> result(rows.size());
+    for (size_t i = 0; i < rows.size(); i++)
+        result[i] = datumValue<bool>(*e->eval(*rows[i]));
+    /* select() keeps the same rows */
+    size_t n = e->select(batch.data(), batch.size());
+    size_t next = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (result[i])
+            REQUIRE ( (next < n && batch[next++] == rows[i].get()) );
+    }
+    REQUIRE ( next == n );
+    return result;
+}
+
+TEST_CASE ( "simplifyExpr specializes comparisons of a column with a constant", "[exprs]" ) {
+    unique_ptr<Expr> flipped = CompareExpr::make(ConstExpr::makeInt(5), VarExpr::make(0), LT);
+    simplifyExpr(flipped);
+    REQUIRE ( dynamic_cast<ColumnCompareExpr<int, GT> *>(flipped.get()) );
+
+    for (CompareOp op: { LT, LTE, EQ, GTE, GT }) {
+        unique_ptr<Expr> original = CompareExpr::make(VarExpr::make(0),
+                                                      ConstExpr::makeBoxed<string>("c"), op);
+        unique_ptr<Expr> specialized = CompareExpr::make(VarExpr::make(0),
+                                                         ConstExpr::makeBoxed<string>("c"), op);
+        simplifyExpr(specialized);
+        REQUIRE ( !dynamic_cast<CompareExpr *>(specialized.get()) );
+        REQUIRE ( selectedStrings(specialized) == selectedStrings(original) );
+    }
+}
+
 TEST_CASE ( "AndExpr", "[exprs]" ) {
     Tuple tuple;
 
@@ -183,3 +292,298 @@ TEST_CASE ( "NotExpr", "[exprs]" ) {
     );
     REQUIRE ( datumValue<bool>(*e2->eval(tuple)) == true );
 }
+
+TEST_CASE ( "ArithExpr", "[exprs]" ) {
+    Tuple tuple;
+    tuple.push_back(make_unique<BigIntDatum>(40));
+    tuple.push_back(make_unique<NullDatum>());
+
+    unique_ptr<Expr> e1 = ArithExpr::make(VarExpr::make(0), ConstExpr::makeBoxed<long long>(2), ADD);
+    REQUIRE ( datumValue<long long>(*e1->eval(tuple)) == 42 );
+
+    unique_ptr<Expr> e2 = ArithExpr::make(ConstExpr::makeDecimal(0.06),
+                                          ConstExpr::makeDecimal(0.01), SUBTRACT);
+    REQUIRE ( datumValue<double>(*e2->eval(tuple)) == 0.06 - 0.01 );
+
+    unique_ptr<Expr> e3 = ArithExpr::make(VarExpr::make(0), VarExpr::make(1), SUBTRACT);
+    REQUIRE ( e3->eval(tuple)->isNull() );
+}
+
+/* x >= 10 AND y = 3 AND 20 > x, on columns x and y */
+static unique_ptr<Expr> rangeAndEquality() {
+    unique_ptr<Expr> e = CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(10), GTE);
+    e = AndExpr::make(move(e), CompareExpr::make(VarExpr::make(1), ConstExpr::makeInt(3), EQ));
+    return AndExpr::make(move(e), CompareExpr::make(ConstExpr::makeInt(20), VarExpr::make(0), GT));
+}
+
+TEST_CASE ( "simplifyExpr folds constants", "[exprs]" ) {
+    Tuple tuple;
+    tuple.push_back(make_unique<DoubleDatum>(0.06));
+
+    /* l_discount >= 0.06 - 0.01 - 1e-6 */
+    unique_ptr<Expr> e1 = CompareExpr::make(VarExpr::make(0),
+        ArithExpr::make(ArithExpr::make(ConstExpr::makeDecimal(0.06),
+                                        ConstExpr::makeDecimal(0.01), SUBTRACT),
+                        ConstExpr::makeDecimal(1e-6), SUBTRACT), GTE);
+    simplifyExpr(e1);
+    REQUIRE ( datumValue<bool>(*e1->eval(tuple)) == true );
+
+    unique_ptr<Expr> e2 = CompareExpr::make(ConstExpr::makeInt(2), ConstExpr::makeInt(3), LT);
+    simplifyExpr(e2);
+    REQUIRE ( e2->constantValue() );
+    REQUIRE ( datumValue<bool>(*e2->constantValue()) == true );
+
+    unique_ptr<Expr> e3 = NotExpr::make(ConstExpr::makeBoxed<bool>(true));
+    simplifyExpr(e3);
+    REQUIRE ( datumValue<bool>(*e3->constantValue()) == false );
+
+    /* arithmetic on a column is kept */
+    unique_ptr<Expr> e4 = ArithExpr::make(VarExpr::make(0), ConstExpr::makeDecimal(1), ADD);
+    Expr *kept = e4.get();
+    simplifyExpr(e4);
+    REQUIRE ( e4.get() == kept );
+}
+
+TEST_CASE ( "simplifyExpr simplifies boolean logic", "[exprs]" ) {
+    unique_ptr<Expr> e1 = AndExpr::make(ConstExpr::makeBoxed<bool>(true),
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(5), EQ));
+    simplifyExpr(e1);
+    REQUIRE ( !dynamic_cast<AndExpr *>(e1.get()) );
+
+    unique_ptr<Expr> e2 = AndExpr::make(VarExpr::make(0),
+        NotExpr::make(ConstExpr::makeBoxed<bool>(true)));
+    simplifyExpr(e2);
+    REQUIRE ( e2->constantValue() );
+    REQUIRE ( datumValue<bool>(*e2->constantValue()) == false );
+
+    unique_ptr<Expr> e3 = OrExpr::make(VarExpr::make(0), ConstExpr::makeBoxed<bool>(false));
+    simplifyExpr(e3);
+    REQUIRE ( dynamic_cast<VarExpr *>(e3.get()) );
+
+    unique_ptr<Expr> e4 = OrExpr::make(VarExpr::make(0), ConstExpr::makeBoxed<bool>(true));
+    simplifyExpr(e4);
+    REQUIRE ( datumValue<bool>(*e4->constantValue()) == true );
+
+    unique_ptr<Expr> negated = CompareExpr::make(VarExpr::make(0), VarExpr::make(1), LT);
+    Expr *inner = negated.get();
+    unique_ptr<Expr> e5 = NotExpr::make(NotExpr::make(move(negated)));
+    simplifyExpr(e5);
+    REQUIRE ( e5.get() == inner );
+}
+
+TEST_CASE ( "simplifyExpr rewrites ranges into BETWEEN", "[exprs]" ) {
+    unique_ptr<Expr> range = AndExpr::make(
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeBoxed<Date>(Date(1994, 1, 1)), GTE),
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeBoxed<Date>(Date(1995, 1, 1)), LT));
+    simplifyExpr(range);
+    REQUIRE ( dynamic_cast<BetweenExpr<Date> *>(range.get()) );
+
+    /* bounds of different types are left alone */
+    unique_ptr<Expr> mixed = AndExpr::make(
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(1), GT),
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeDecimal(2), LT));
+    simplifyExpr(mixed);
+    REQUIRE ( dynamic_cast<AndExpr *>(mixed.get()) );
+
+    /* the pair is found across nested ANDs, and gives the same results, also for NULL */
+    unique_ptr<Expr> original = rangeAndEquality();
+    unique_ptr<Expr> simplified = rangeAndEquality();
+    simplifyExpr(simplified);
+    REQUIRE ( dynamic_cast<AndExpr *>(simplified.get()) );
+    for (int x = 5; x <= 25; x++) {
+        for (int y = 2; y <= 4; y++) {
+            Tuple tuple;
+            if (x == 25)
+                tuple.push_back(make_unique<NullDatum>());
+            else
+                tuple.push_back(make_unique<IntDatum>(x));
+            tuple.push_back(make_unique<IntDatum>(y));
+            REQUIRE ( datumValue<bool>(*simplified->eval(tuple)) ==
+                      datumValue<bool>(*original->eval(tuple)) );
+        }
+    }
+}
+
+TEST_CASE ( "InExpr", "[exprs]" ) {
+    vector<unique_ptr<Expr>> list;
+    list.push_back(ConstExpr::makeInt(3));
+    list.push_back(make_unique<ConstExpr>(make_unique<NullDatum>()));
+    list.push_back(VarExpr::make(1));
+    unique_ptr<Expr> e = InExpr::make(VarExpr::make(0), move(list));
+
+    Tuple tuple;
+    tuple.push_back(make_unique<IntDatum>(3));
+    tuple.push_back(make_unique<IntDatum>(7));
+    REQUIRE ( datumValue<bool>(*e->eval(tuple)) );
+    tuple[0] = make_unique<IntDatum>(7);
+    REQUIRE ( datumValue<bool>(*e->eval(tuple)) );
+    tuple[0] = make_unique<IntDatum>(5);
+    REQUIRE ( !datumValue<bool>(*e->eval(tuple)) );
+    /* NULL is in no list, even one with NULLs */
+    tuple[0] = make_unique<NullDatum>();
+    tuple[1] = make_unique<NullDatum>();
+    REQUIRE ( !datumValue<bool>(*e->eval(tuple)) );
+
+    vector<unique_ptr<Expr>> nulls;
+    nulls.push_back(make_unique<ConstExpr>(make_unique<NullDatum>()));
+    unique_ptr<Expr> none = InExpr::make(VarExpr::make(0), move(nulls));
+    simplifyExpr(none);
+    REQUIRE ( none->constantValue() );
+    REQUIRE ( !datumValue<bool>(*none->constantValue()) );
+}
+
+/*
+ * Simplifies column 0 IN (list), checks the lookup it picked, and that
+ * eval() and select() find the values of the list among probes and NULL.
+ */
+template <class T>
+static void checkColumnIn(const vector<T> &values, const vector<T> &probes, InLookup lookup) {
+    vector<unique_ptr<Expr>> list;
+    for (const T &value: values)
+        list.push_back(make_unique<ConstExpr>(make_unique<typename DatumOf<T>::type>(value)));
+    unique_ptr<Expr> e = InExpr::make(VarExpr::make(0), move(list));
+    simplifyExpr(e);
+    auto *in = dynamic_cast<ColumnInExpr<T> *>(e.get());
+    REQUIRE ( in );
+    REQUIRE ( in->getLookup() == lookup );
+
+    vector<TupleP> rows;
+    vector<Tuple *> batch;
+    vector<Tuple *> expected;
+    for (size_t i = 0; i <= probes.size(); i++) {
+        TupleP tuple = make_unique<Tuple>();
+        if (i < probes.size())
+            tuple->push_back(make_unique<typename DatumOf<T>::type>(probes[i]));
+        else
+            tuple->push_back(make_unique<NullDatum>());
+        bool found = i < probes.size() &&
+                     find(values.begin(), values.end(), probes[i]) != values.end();
+        REQUIRE ( datumValue<bool>(*e->eval(*tuple)) == found );
+        if (found)
+            expected.push_back(tuple.get());
+        batch.push_back(tuple.get());
+        rows.push_back(move(tuple));
+    }
+    size_t n = e->select(batch.data(), batch.size());
+    REQUIRE ( vector<Tuple *>(batch.begin(), batch.begin() + n) == expected );
+}
+
+TEST_CASE ( "simplifyExpr picks the lookup of IN lists by size and type", "[exprs]" ) {
+    vector<int> small, sparse, probes;
+    for (int i = -50; i < 50; i++)
+        probes.push_back(i * 100003);
+    for (int i = -1000; i < 1000; i++)
+        probes.push_back(i);
+    for (int i = 0; i < 2000; i++)
+        sparse.push_back(i * 100003);
+
+    checkColumnIn<int>({ -3, 40, 17, 40 }, probes, IN_BITMAP);
+    checkColumnIn<int>({ -3, 100003, 500000, 0 }, probes, IN_LINEAR);
+    checkColumnIn<int>(vector<int>(sparse.begin(), sparse.begin() + 40), probes, IN_PERFECT_HASH);
+    checkColumnIn<int>(vector<int>(sparse.begin(), sparse.begin() + 500), probes, IN_SORTED);
+    checkColumnIn<int>(sparse, probes, IN_HASH);
+    checkColumnIn<long long>({ -(1LL << 40), 0, 1LL << 40 }, { -(1LL << 40), 1, 1LL << 40 }, IN_LINEAR);
+    checkColumnIn<double>({ 0.5, 1.5, 2.5 }, { 0.5, 1.0, 2.5, 3.0 }, IN_LINEAR);
+    checkColumnIn<Date>({ Date(1994, 1, 1), Date(1995, 6, 17) },
+                        { Date(1994, 1, 1), Date(1994, 1, 2), Date(1995, 6, 17) }, IN_LINEAR);
+
+    vector<string> words, wordProbes;
+    for (int i = 0; i < 200; i++) {
+        words.push_back("MAIL" + to_string(i * 7));
+        wordProbes.push_back("MAIL" + to_string(i));
+    }
+    checkColumnIn<string>({ "MAIL", "SHIP" }, { "MAIL", "AIR", "SHIP", "" }, IN_LINEAR);
+    checkColumnIn<string>(vector<string>(words.begin(), words.begin() + 30), wordProbes,
+                          IN_PERFECT_HASH);
+    checkColumnIn<string>(words, wordProbes, IN_HASH);
+}
+
+TEST_CASE ( "AndExpr and OrExpr short-circuit", "[exprs]" ) {
+    Tuple tuple;
+    tuple.push_back(make_unique<IntDatum>(1));
+    size_t evaluations = 0;
+
+    unique_ptr<Expr> e1 = AndExpr::make(
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(0), EQ),
+        make_unique<CountingExpr>(ConstExpr::makeBoxed<bool>(true), evaluations));
+    REQUIRE ( datumValue<bool>(*e1->eval(tuple)) == false );
+    REQUIRE ( evaluations == 0 );
+
+    unique_ptr<Expr> e2 = OrExpr::make(
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(1), EQ),
+        make_unique<CountingExpr>(ConstExpr::makeBoxed<bool>(false), evaluations));
+    REQUIRE ( datumValue<bool>(*e2->eval(tuple)) == true );
+    REQUIRE ( evaluations == 0 );
+
+    tuple[0] = make_unique<IntDatum>(0);
+    REQUIRE ( datumValue<bool>(*e1->eval(tuple)) == true );
+    REQUIRE ( datumValue<bool>(*e2->eval(tuple)) == false );
+    REQUIRE ( evaluations == 2 );
+}
+
+TEST_CASE ( "AndExpr::select runs the most selective conjuncts first", "[exprs]" ) {
+    vector<TupleP> rows;
+    for (int i = 0; i < 1000; i++) {
+        TupleP tuple = make_unique<Tuple>();
+        tuple->push_back(make_unique<IntDatum>(i));
+        rows.push_back(move(tuple));
+    }
+    /* x >= 0, which keeps all rows, AND x < 10, which keeps 1% of them */
+    size_t allCount = 0, fewCount = 0;
+    unique_ptr<Expr> e = AndExpr::make(
+        make_unique<CountingExpr>(
+            CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(0), GTE), allCount),
+        make_unique<CountingExpr>(
+            CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(10), LT), fewCount));
+
+    vector<Tuple *> batch;
+    size_t batches = 4 * AndExpr::rankInterval;
+    for (size_t b = 0; b < batches; b++) {
+        batch.clear();
+        for (const TupleP &row: rows)
+            batch.push_back(row.get());
+        size_t selected = e->select(batch.data(), batch.size());
+        REQUIRE ( selected == 10 );
+        for (size_t i = 0; i < selected; i++)
+            REQUIRE ( datumValue<int>(*(*batch[i])[0]) == (int) i );
+    }
+    /* the second conjunct moves to the front after the first ranking */
+    REQUIRE ( fewCount == batches * 1000 );
+    REQUIRE ( allCount == AndExpr::rankInterval * 1000 + (batches - AndExpr::rankInterval) * 10 );
+}
+
+TEST_CASE ( "AndExpr::select measures conjuncts again which saw no rows", "[exprs]" ) {
+    vector<TupleP> rows;
+    for (int i = 0; i < 100; i++) {
+        TupleP tuple = make_unique<Tuple>();
+        tuple->push_back(make_unique<IntDatum>(i));
+        rows.push_back(move(tuple));
+    }
+    /* x >= 90 AND x >= 0, where the second conjunct drops no rows, so it stays last */
+    size_t secondCount = 0;
+    unique_ptr<Expr> e = AndExpr::make(
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(90), GTE),
+        make_unique<CountingExpr>(
+            CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(0), GTE), secondCount));
+
+    vector<Tuple *> batch;
+    auto runInterval = [&]() {
+        for (size_t b = 0; b < AndExpr::rankInterval; b++) {
+            batch.clear();
+            for (const TupleP &row: rows)
+                batch.push_back(row.get());
+            e->select(batch.data(), batch.size());
+        }
+    };
+    runInterval();
+    REQUIRE ( secondCount == AndExpr::rankInterval * 10 );
+
+    /* now the first conjunct drops all rows, and the second sees none */
+    for (const TupleP &row: rows)
+        (*row)[0] = make_unique<IntDatum>(10);
+    runInterval();
+    REQUIRE ( secondCount == AndExpr::rankInterval * 10 );
+    /* it lost its statistics, so it runs first and is measured again */
+    runInterval();
+    REQUIRE ( secondCount == AndExpr::rankInterval * 110 );
+}
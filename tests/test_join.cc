@@ -0,0 +1,393 @@
+#include "catch.hpp"
+#include "counting_expr.h"
+#include "int_tables.h"
+#include <expr.h>
+#include <tuple.h>
+#include <rowstore.h>
+#include <join.h>
+#include <pipeline.h>
+#include <memory>
+#include <algorithm>
+using namespace std;
+
+static vector<unique_ptr<Expr>> columnKeys(const vector<int> &columns) {
+    vector<unique_ptr<Expr>> result;
+    for (int column: columns)
+        result.push_back(VarExpr::make(column));
+    return result;
+}
+
+static vector<string> sortedRows(ExecNode &node) {
+    vector<string> rows;
+    for (const TupleP &tuple: node.eval())
+        rows.push_back(tupleToString(*tuple));
+    sort(rows.begin(), rows.end());
+    return rows;
+}
+
+/* orders(orderkey, custkey) and lineitem(orderkey, quantity) */
+const vector<int> orders { 1, 100,
+                           2, 200,
+                           3, 300,
+                           3, 301,
+                           5, 500 };
+const vector<int> lineitem { 1, 10,
+                             1, 11,
+                             3, 30,
+                             4, 40 };
+
+TEST_CASE ( "ExecHashJoin, inner join", "[join]" ) {
+    ExecHashJoin join(make_unique<ExecScan>(createIntTable(2, lineitem)),
+                      make_unique<ExecScan>(createIntTable(2, orders)),
+                      columnKeys({0}), columnKeys({0}), JOIN_INNER);
+
+    vector<TupleP> result = join.eval();
+
+    /* duplicate keys on both sides */
+    REQUIRE ( result.size() == 4 );
+    vector<string> rows;
+    for (const TupleP &tuple: result)
+        rows.push_back(tupleToString(*tuple));
+    sort(rows.begin(), rows.end());
+    REQUIRE ( rows == vector<string>({ "1,10,1,100", "1,11,1,100",
+                                       "3,30,3,300", "3,30,3,301" }) );
+}
+
+TEST_CASE ( "ExecHashJoin, left join", "[join]" ) {
+    ExecHashJoin join(make_unique<ExecScan>(createIntTable(2, lineitem)),
+                      make_unique<ExecScan>(createIntTable(2, orders)),
+                      columnKeys({0}), columnKeys({0}), JOIN_LEFT, 2);
+
+    vector<TupleP> result = join.eval();
+
+    REQUIRE ( result.size() == 5 );
+    REQUIRE ( tupleToString(*result[4]) == "4,40,NULL,NULL" );
+}
+
+TEST_CASE ( "Left joins need the number of build columns", "[join]" ) {
+    REQUIRE_THROWS_AS ( ExecHashJoin(make_unique<ExecScan>(createIntTable(2, lineitem)),
+                                     make_unique<ExecScan>(createIntTable(2, orders)),
+                                     columnKeys({0}), columnKeys({0}), JOIN_LEFT),
+                        invalid_argument );
+    REQUIRE_THROWS_AS ( ExecRadixJoin(make_unique<ExecScan>(createIntTable(2, lineitem)),
+                                      make_unique<ExecScan>(createIntTable(2, orders)),
+                                      columnKeys({0}), columnKeys({0}), JOIN_LEFT),
+                        invalid_argument );
+    REQUIRE_THROWS_AS ( ExecMergeJoin(make_unique<ExecScan>(createIntTable(2, lineitem)),
+                                      make_unique<ExecScan>(createIntTable(2, orders)),
+                                      columnKeys({0}), columnKeys({0}), JOIN_LEFT),
+                        invalid_argument );
+}
+
+TEST_CASE ( "ExecHashJoin, semi join", "[join]" ) {
+    ExecHashJoin join(make_unique<ExecScan>(createIntTable(2, orders)),
+                      make_unique<ExecScan>(createIntTable(2, lineitem)),
+                      columnKeys({0}), columnKeys({0}), JOIN_SEMI);
+
+    vector<TupleP> result = join.eval();
+
+    /* orders which have a lineitem, each only once */
+    REQUIRE ( result.size() == 3 );
+    REQUIRE ( tupleToString(*result[0]) == "1,100" );
+    REQUIRE ( tupleToString(*result[1]) == "3,300" );
+    REQUIRE ( tupleToString(*result[2]) == "3,301" );
+}
+
+TEST_CASE ( "ExecHashJoin, anti join", "[join]" ) {
+    vector<TupleP> probeRows = createIntTable(2, orders);
+    (*probeRows[1])[0] = make_unique<NullDatum>();
+    ExecHashJoin join(make_unique<ExecScan>(move(probeRows)),
+                      make_unique<ExecScan>(createIntTable(2, lineitem)),
+                      columnKeys({0}), columnKeys({0}), JOIN_ANTI);
+
+    /* NOT EXISTS: orders without a lineitem, including the one with a NULL key */
+    REQUIRE ( sortedRows(join) == vector<string>({ "5,500", "NULL,200" }) );
+}
+
+/* mark of each probe row of (1, 2, NULL) IN build */
+static vector<string> markJoin(vector<TupleP> buildRows, bool radix) {
+    vector<TupleP> probeRows = createIntTable(1, { 1, 2, 0 });
+    (*probeRows[2])[0] = make_unique<NullDatum>();
+    unique_ptr<ExecNode> join;
+    if (radix)
+        join = make_unique<ExecRadixJoin>(make_unique<ExecScan>(move(probeRows)),
+                                          make_unique<ExecScan>(move(buildRows)),
+                                          columnKeys({0}), columnKeys({0}), JOIN_MARK);
+    else
+        join = make_unique<ExecHashJoin>(make_unique<ExecScan>(move(probeRows)),
+                                         make_unique<ExecScan>(move(buildRows)),
+                                         columnKeys({0}), columnKeys({0}), JOIN_MARK);
+    return sortedRows(*join);
+}
+
+TEST_CASE ( "Mark join follows the NULL semantics of IN", "[join]" ) {
+    for (bool radix: { false, true }) {
+        REQUIRE ( markJoin(createIntTable(1, { 1, 3 }), radix) ==
+                  vector<string>({ "1,1", "2,0", "NULL,NULL" }) );
+
+        /* a NULL on the build side makes every unmatched row unknown */
+        vector<TupleP> buildRows = createIntTable(1, { 1, 0 });
+        (*buildRows[1])[0] = make_unique<NullDatum>();
+        REQUIRE ( markJoin(move(buildRows), radix) ==
+                  vector<string>({ "1,1", "2,NULL", "NULL,NULL" }) );
+
+        /* x IN (empty set) is false, even for a NULL x */
+        REQUIRE ( markJoin(vector<TupleP>(), radix) ==
+                  vector<string>({ "1,0", "2,0", "NULL,0" }) );
+    }
+}
+
+TEST_CASE ( "ExecHashJoin, expression keys and NULLs", "[join]" ) {
+    vector<TupleP> probeRows = createIntTable(2, { 1, 2,
+                                             2, 3,
+                                             3, 1 });
+    (*probeRows[2])[0] = make_unique<NullDatum>();
+    vector<TupleP> buildRows = createIntTable(1, { 2, 6, 3 });
+    buildRows.push_back(make_unique<Tuple>());
+    buildRows.back()->push_back(make_unique<NullDatum>());
+
+    /* probe.a * probe.b = build.x */
+    vector<unique_ptr<Expr>> probeKeys;
+    probeKeys.push_back(MultExpr::make(VarExpr::make(0), VarExpr::make(1)));
+    ExecHashJoin join(make_unique<ExecScan>(move(probeRows)),
+                      make_unique<ExecScan>(move(buildRows)),
+                      move(probeKeys), columnKeys({0}), JOIN_INNER);
+
+    vector<TupleP> result = join.eval();
+
+    REQUIRE ( result.size() == 2 );
+    REQUIRE ( tupleToString(*result[0]) == "1,2,2" );
+    REQUIRE ( tupleToString(*result[1]) == "2,3,6" );
+}
+
+TEST_CASE ( "ExecHashJoin, many rows", "[join]" ) {
+    vector<int> build, probe;
+    for (int i = 0; i < 10000; i++)
+        build.push_back(i * 2);
+    for (int i = 0; i < 20000; i++)
+        probe.push_back(i);
+    ExecHashJoin join(make_unique<ExecScan>(createIntTable(1, probe)),
+                      make_unique<ExecScan>(createIntTable(1, build)),
+                      columnKeys({0}), columnKeys({0}), JOIN_INNER);
+
+    vector<TupleP> result = join.eval();
+
+    REQUIRE ( result.size() == 10000 );
+    for (size_t i = 0; i < result.size(); i++) {
+        REQUIRE ( fieldValue<int>(result[i], 0) == 2 * i );
+        REQUIRE ( fieldValue<int>(result[i], 1) == 2 * i );
+    }
+}
+
+TEST_CASE ( "Interleaved probes give the same results as simple probes", "[join]" ) {
+    vector<int> build, probe;
+    for (int i = 0; i < 5000; i++) {
+        build.push_back(i * 3 % 4001);
+        build.push_back(i % 3);
+        probe.push_back(i % 2000);
+        probe.push_back(i % 5);
+    }
+
+    for (JoinType type: { JOIN_INNER, JOIN_LEFT, JOIN_SEMI, JOIN_ANTI, JOIN_MARK }) {
+        vector<string> results[2];
+        for (ProbeMode mode: { PROBE_SIMPLE, PROBE_INTERLEAVED }) {
+            vector<TupleP> probeRows = createIntTable(2, probe);
+            (*probeRows[7])[1] = make_unique<NullDatum>();
+
+            /* probe.a * probe.b = build.x * build.y, which evaluates to temporaries */
+            vector<unique_ptr<Expr>> probeKeys, buildKeys;
+            probeKeys.push_back(MultExpr::make(VarExpr::make(0), VarExpr::make(1)));
+            buildKeys.push_back(MultExpr::make(VarExpr::make(0), VarExpr::make(1)));
+            ExecHashJoin join(make_unique<ExecScan>(move(probeRows)),
+                              make_unique<ExecScan>(createIntTable(2, build)),
+                              move(probeKeys), move(buildKeys), type, 2, mode);
+            results[mode == PROBE_INTERLEAVED] = sortedRows(join);
+        }
+        REQUIRE ( !results[0].empty() );
+        REQUIRE ( results[1] == results[0] );
+    }
+}
+
+TEST_CASE ( "Interleaved probes evaluate each probe key once", "[join]" ) {
+    vector<int> build, probe;
+    for (int i = 0; i < 3000; i++) {
+        build.push_back(i % 1000);
+        probe.push_back(i % 2000);
+    }
+    for (ProbeMode mode: { PROBE_SIMPLE, PROBE_INTERLEAVED }) {
+        size_t evaluations = 0;
+        vector<unique_ptr<Expr>> probeKeys;
+        probeKeys.push_back(make_unique<CountingExpr>(VarExpr::make(0), evaluations));
+        ExecHashJoin join(make_unique<ExecScan>(createIntTable(1, probe)),
+                          make_unique<ExecScan>(createIntTable(1, build)),
+                          move(probeKeys), columnKeys({0}), JOIN_LEFT, 1, mode);
+        /*
+         * the 2000 probe rows below 1000 match the 3 build rows with their
+         * value. A left join pushes no key filter, which would evaluate the
+         * probe keys too.
+         */
+        REQUIRE ( join.eval().size() == 2000 * 3 + 1000 );
+        REQUIRE ( evaluations == probe.size() );
+    }
+}
+
+TEST_CASE ( "ExecRadixJoin gives the same results as ExecHashJoin", "[join]" ) {
+    vector<int> build, probe;
+    for (int i = 0; i < 20000; i++) {
+        build.push_back(i * 3 % 7919);
+        build.push_back(i);
+    }
+    for (int i = 0; i < 30000; i++) {
+        probe.push_back(i % 9000);
+        probe.push_back(i);
+    }
+
+    for (JoinType type: { JOIN_INNER, JOIN_LEFT, JOIN_SEMI, JOIN_ANTI, JOIN_MARK }) {
+        ExecHashJoin hashJoin(make_unique<ExecScan>(createIntTable(2, probe)),
+                              make_unique<ExecScan>(createIntTable(2, build)),
+                              columnKeys({0}), columnKeys({0}), type, 2);
+        vector<string> expected = sortedRows(hashJoin);
+
+        /* partitions picked from the build size, and two partitioning passes */
+        for (int radixBits: { -1, 10 }) {
+            ExecRadixJoin radixJoin(make_unique<ExecScan>(createIntTable(2, probe)),
+                                    make_unique<ExecScan>(createIntTable(2, build)),
+                                    columnKeys({0}), columnKeys({0}), type, 2,
+                                    4, radixBits);
+            REQUIRE ( sortedRows(radixJoin) == expected );
+        }
+    }
+}
+
+TEST_CASE ( "ExecRadixJoin, left join with NULL keys", "[join]" ) {
+    vector<TupleP> probeRows = createIntTable(2, lineitem);
+    (*probeRows[1])[0] = make_unique<NullDatum>();
+    ExecRadixJoin join(make_unique<ExecScan>(move(probeRows)),
+                       make_unique<ExecScan>(createIntTable(2, orders)),
+                       columnKeys({0}), columnKeys({0}), JOIN_LEFT, 2, 2);
+
+    REQUIRE ( sortedRows(join) == vector<string>({ "1,10,1,100", "3,30,3,300",
+                                                   "3,30,3,301", "4,40,NULL,NULL",
+                                                   "NULL,11,NULL,NULL" }) );
+}
+
+TEST_CASE ( "Joins push key filters into the probe side", "[join]" ) {
+    /* build keys are the even numbers of 1000 to 2000 */
+    vector<int> build, probe;
+    for (int i = 1000; i <= 2000; i += 2)
+        build.push_back(i);
+    for (int i = 0; i < 10000; i++)
+        probe.push_back(i);
+
+    ExecHashJoin hashJoin(make_unique<ExecScan>(createIntTable(1, probe)),
+                          make_unique<ExecScan>(createIntTable(1, build)),
+                          columnKeys({0}), columnKeys({0}), JOIN_INNER);
+    REQUIRE ( hashJoin.eval().size() == 501 );
+    /* out of range rows, and most of the odd numbers in range */
+    REQUIRE ( hashJoin.getKeyFilter()->rowsDropped() > 9000 + 400 );
+
+    /* a probe side filter takes it as well */
+    ExecRadixJoin radixJoin(make_unique<ExecFilter>(make_unique<ExecScan>(createIntTable(1, probe)),
+                                                    ConstExpr::makeBoxed<bool>(true)),
+                            make_unique<ExecScan>(createIntTable(1, build)),
+                            columnKeys({0}), columnKeys({0}), JOIN_SEMI, 0, 2);
+    REQUIRE ( radixJoin.eval().size() == 501 );
+    REQUIRE ( radixJoin.getKeyFilter()->rowsDropped() > 9000 + 400 );
+
+    /* left joins have to see every probe row */
+    ExecHashJoin leftJoin(make_unique<ExecScan>(createIntTable(1, probe)),
+                          make_unique<ExecScan>(createIntTable(1, build)),
+                          columnKeys({0}), columnKeys({0}), JOIN_LEFT, 1);
+    REQUIRE ( leftJoin.getKeyFilter() == NULL );
+    REQUIRE ( leftJoin.eval().size() == 10000 );
+
+    /* an empty build side drops every probe row */
+    ExecHashJoin emptyJoin(make_unique<ExecScan>(createIntTable(1, probe)),
+                           make_unique<ExecScan>(vector<TupleP>()),
+                           columnKeys({0}), columnKeys({0}), JOIN_INNER);
+    REQUIRE ( emptyJoin.eval().empty() );
+    REQUIRE ( emptyJoin.getKeyFilter()->rowsDropped() == 10000 );
+}
+
+TEST_CASE ( "ExecMergeJoin, sorted inputs with duplicate keys", "[join]" ) {
+    /* lineitem and orders are both ordered on orderkey */
+    ExecMergeJoin join(make_unique<ExecScan>(createIntTable(2, { 1, 10,
+                                                           1, 11,
+                                                           3, 30,
+                                                           3, 31,
+                                                           4, 40 })),
+                       make_unique<ExecScan>(createIntTable(2, orders)),
+                       columnKeys({0}), columnKeys({0}), JOIN_INNER);
+
+    vector<TupleP> result = join.eval();
+
+    REQUIRE ( result.size() == 6 );
+    vector<string> rows;
+    for (const TupleP &tuple: result)
+        rows.push_back(tupleToString(*tuple));
+    REQUIRE ( rows == vector<string>({ "1,10,1,100", "1,11,1,100",
+                                       "3,30,3,300", "3,30,3,301",
+                                       "3,31,3,300", "3,31,3,301" }) );
+}
+
+TEST_CASE ( "ExecMergeJoin gives the same results as ExecHashJoin", "[join]" ) {
+    vector<int> build, probe;
+    for (int i = 0; i < 3000; i++) {
+        build.push_back(i * 7 % 1000);
+        build.push_back(i);
+        probe.push_back(i * 11 % 1500);
+        probe.push_back(i);
+    }
+
+    for (JoinType type: { JOIN_INNER, JOIN_LEFT, JOIN_SEMI, JOIN_ANTI }) {
+        ExecHashJoin hashJoin(make_unique<ExecScan>(createIntTable(2, probe)),
+                              make_unique<ExecScan>(createIntTable(2, build)),
+                              columnKeys({0}), columnKeys({0}), type, 2);
+        /* inputs are not ordered, so let the join sort them */
+        ExecMergeJoin mergeJoin(make_unique<ExecScan>(createIntTable(2, probe)),
+                                make_unique<ExecScan>(createIntTable(2, build)),
+                                columnKeys({0}), columnKeys({0}), type, 2, true);
+        REQUIRE ( sortedRows(mergeJoin) == sortedRows(hashJoin) );
+    }
+}
+
+TEST_CASE ( "ExecMergeJoin sorts its inputs once it's read", "[join]" ) {
+    vector<int> build, probe;
+    for (int i = 0; i < 3000; i++) {
+        build.push_back(i * 7 % 1000);
+        build.push_back(i);
+        probe.push_back(i * 11 % 1500);
+        probe.push_back(i);
+    }
+    ExecHashJoin hashJoin(make_unique<ExecScan>(createIntTable(2, probe)),
+                          make_unique<ExecScan>(createIntTable(2, build)),
+                          columnKeys({0}), columnKeys({0}));
+    vector<string> expected = sortedRows(hashJoin);
+
+    for (size_t threads: { 0, 1, 2 }) {
+        size_t evaluations = 0;
+        vector<unique_ptr<Expr>> probeKeys;
+        probeKeys.push_back(make_unique<CountingExpr>(VarExpr::make(0), evaluations));
+        ExecMergeJoin mergeJoin(make_unique<ExecScan>(createIntTable(2, probe)),
+                                make_unique<ExecScan>(createIntTable(2, build)),
+                                move(probeKeys), columnKeys({0}), JOIN_INNER, 0, true);
+        REQUIRE ( evaluations == 0 );
+        /* the key of the sort below the join is the key of the join */
+        size_t visited = 0;
+        mergeJoin.visitExprs([&](unique_ptr<Expr> &expr) { visited++; });
+        REQUIRE ( visited == 4 );
+
+        if (threads == 0) {
+            REQUIRE ( sortedRows(mergeJoin) == expected );
+        } else {
+            /* the sorts are pipeline breakers, so each input is sorted by its own pipeline */
+            PipelineExecutor executor(mergeJoin);
+            REQUIRE ( executor.pipelineCount() == 3 );
+            vector<TupleP> rows = executor.run(threads);
+            vector<string> result = tableStrings(rows);
+            sort(result.begin(), result.end());
+            REQUIRE ( result == expected );
+        }
+        REQUIRE ( evaluations > 0 );
+    }
+}
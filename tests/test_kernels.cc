@@ -0,0 +1,120 @@
+#include "catch.hpp"
+#include <kernels.h>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+TEST_CASE ( "sum, min and max kernels", "[kernels]" ) {
+    vector<long long> values;
+    vector<uint32_t> sel;
+    long long sum = 0, selSum = 0, selMax = 0;
+    for (int i = 0; i < 1003; i++) {
+        values.push_back((i * 7919) % 1000 - 500);
+        sum += values.back();
+        if (i % 3 == 0) {
+            sel.push_back(i);
+            selSum += values.back();
+            selMax = max(selMax, values.back());
+        }
+    }
+    REQUIRE ( sumKernel(values.data(), values.size()) == sum );
+    REQUIRE ( sumKernel(values.data(), sel.data(), sel.size()) == selSum );
+    REQUIRE ( minKernel(values.data(), values.size(), 0LL) == -500 );
+    REQUIRE ( maxKernel(values.data(), values.size(), 0LL) == 499 );
+    REQUIRE ( minKernel(values.data(), values.size(), -1000LL) == -1000 );
+    REQUIRE ( maxKernel(values.data(), sel.data(), sel.size(), 0LL) == selMax );
+    REQUIRE ( sumKernel(values.data(), 0) == 0 );
+}
+
+TEST_CASE ( "DeterministicSum doesn't depend on batching", "[kernels]" ) {
+    mt19937 rng(42);
+    uniform_real_distribution<double> dist(-1e6, 1e6);
+    vector<double> values;
+    for (int i = 0; i < 10000; i++)
+        values.push_back(dist(rng) * ((i % 5 == 0) ? 1e-9 : 1.0));
+
+    DeterministicSum rowByRow;
+    for (double v: values)
+        rowByRow.add(v);
+
+    DeterministicSum whole;
+    whole.add(values.data(), values.size());
+
+    DeterministicSum batched;
+    for (size_t i = 0, size = 1; i < values.size(); i += size, size = size * 3 % 1021)
+        batched.add(values.data() + i, min(size, values.size() - i));
+
+    double a = rowByRow.result(), b = whole.result(), c = batched.result();
+    REQUIRE ( memcmp(&a, &b, sizeof(double)) == 0 );
+    REQUIRE ( memcmp(&a, &c, sizeof(double)) == 0 );
+}
+
+TEST_CASE ( "DeterministicSum doesn't depend on order or merging", "[kernels]" ) {
+    mt19937 rng(7);
+    uniform_real_distribution<double> dist(-1e6, 1e6);
+    vector<double> values;
+    for (int i = 0; i < 10000; i++)
+        values.push_back(dist(rng) * ((i % 3 == 0) ? 1e-12 : (i % 3 == 1) ? 1.0 : 1e12));
+
+    DeterministicSum sequential;
+    sequential.add(values.data(), values.size());
+    double expected = sequential.result();
+
+    for (int round = 0; round < 5; round++) {
+        /* split into parts of random sizes, and merge them in random order */
+        vector<DeterministicSum> parts;
+        for (size_t i = 0; i < values.size();) {
+            size_t size = min<size_t>(rng() % 700 + 1, values.size() - i);
+            parts.emplace_back();
+            parts.back().add(values.data() + i, size);
+            i += size;
+        }
+        shuffle(parts.begin(), parts.end(), rng);
+        while (parts.size() > 1) {
+            size_t i = rng() % (parts.size() - 1);
+            parts[i].merge(parts[i + 1]);
+            parts.erase(parts.begin() + i + 1);
+        }
+        double merged = parts[0].result();
+        REQUIRE ( memcmp(&merged, &expected, sizeof(double)) == 0 );
+
+        vector<double> shuffled = values;
+        shuffle(shuffled.begin(), shuffled.end(), rng);
+        DeterministicSum reordered;
+        reordered.add(shuffled.data(), shuffled.size());
+        double result = reordered.result();
+        REQUIRE ( memcmp(&result, &expected, sizeof(double)) == 0 );
+    }
+}
+
+TEST_CASE ( "DeterministicSum compensates rounding errors", "[kernels]" ) {
+    DeterministicSum sum;
+    sum.add(1e100);
+    for (int i = 0; i < 1000; i++)
+        sum.add(1.0);
+    sum.add(-1e100);
+    REQUIRE ( sum.result() == 1000.0 );
+}
+
+TEST_CASE ( "DeterministicSum of negative, subnormal and special values", "[kernels]" ) {
+    DeterministicSum sum;
+    sum.add(-2.5);
+    sum.add(0.75);
+    sum.add(5e-324);
+    sum.add(-5e-324);
+    REQUIRE ( sum.result() == -1.75 );
+
+    DeterministicSum tiny;
+    tiny.add(5e-324);
+    tiny.add(5e-324);
+    REQUIRE ( tiny.result() == 1e-323 );
+
+    DeterministicSum infinite;
+    infinite.add(1.0);
+    infinite.add(HUGE_VAL);
+    REQUIRE ( infinite.result() == HUGE_VAL );
+    infinite.add(-HUGE_VAL);
+    REQUIRE ( std::isnan(infinite.result()) );
+}
@@ -0,0 +1,98 @@
+#include "catch.hpp"
+#include "int_tables.h"
+#include <expr.h>
+#include <tuple.h>
+#include <rowstore.h>
+#include <join.h>
+#include <sort.h>
+#include <pipeline.h>
+#include <memory>
+using namespace std;
+
+/* rows of (i % 97, i % 13, i) */
+static vector<TupleP> numberRows(int count) {
+    vector<int> values;
+    for (int i = 0; i < count; i++) {
+        values.push_back(i % 97);
+        values.push_back(i % 13);
+        values.push_back(i);
+    }
+    return createIntTable(3, values);
+}
+
+/*
+ * select b, 2 * sum(c) from numbers where a < 50 group by b order by 2 desc,
+ * which is cut into pipelines at the aggregate and the sort
+ */
+static unique_ptr<ExecNode> groupedSums() {
+    auto filterNode = make_unique<ExecFilter>(make_unique<ExecScan>(numberRows(20000)),
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(50), LT));
+    vector<unique_ptr<AggFuncCall>> aggs;
+    aggs.push_back(AggSum<int>::makeCall(VarExpr::make(2)));
+    auto aggNode = make_unique<ExecAgg>(move(filterNode), vector<int> { 1 }, move(aggs));
+    vector<unique_ptr<Expr>> exprs;
+    exprs.push_back(VarExpr::make(0));
+    exprs.push_back(MultExpr::make(ConstExpr::makeInt(2), VarExpr::make(1)));
+    auto projectNode = make_unique<ExecProject>(move(aggNode), move(exprs));
+    vector<SortKey> keys;
+    keys.push_back({ VarExpr::make(1), true });
+    return make_unique<ExecSort>(move(projectNode), move(keys));
+}
+
+/*
+ * count(*) of numbers joined on b with the groups of numbers where c < 100,
+ * grouped by b. The aggregate on the probe side and the build side of the
+ * join don't depend on each other.
+ */
+static unique_ptr<ExecNode> joinedCount() {
+    vector<unique_ptr<AggFuncCall>> aggs;
+    aggs.push_back(AggCount::makeStarCall());
+    auto probeNode = make_unique<ExecAgg>(make_unique<ExecScan>(numberRows(3000)),
+                                          vector<int> { 1 }, move(aggs));
+    auto buildNode = make_unique<ExecFilter>(make_unique<ExecScan>(numberRows(3000)),
+        CompareExpr::make(VarExpr::make(2), ConstExpr::makeInt(100), LT));
+    vector<unique_ptr<Expr>> probeKeys, buildKeys;
+    probeKeys.push_back(VarExpr::make(0));
+    buildKeys.push_back(VarExpr::make(1));
+    return make_unique<ExecCount>(make_unique<ExecHashJoin>(
+        move(probeNode), move(buildNode), move(probeKeys), move(buildKeys)));
+}
+
+TEST_CASE ( "PipelineExecutor cuts plans at pipeline breakers", "[pipeline]" ) {
+    vector<string> expected = tableStrings(groupedSums()->eval());
+    REQUIRE ( expected.size() == 13 );
+
+    for (size_t threads: { 1, 4 }) {
+        unique_ptr<ExecNode> plan = groupedSums();
+        PipelineExecutor executor(*plan);
+        /* into the aggregate, into the sort, and into the result */
+        REQUIRE ( executor.pipelineCount() == 3 );
+        REQUIRE ( tableStrings(executor.run(threads)) == expected );
+    }
+}
+
+TEST_CASE ( "PipelineExecutor runs join build sides as pipelines", "[pipeline]" ) {
+    vector<string> expected = tableStrings(joinedCount()->eval());
+    /* each group of b joins the 100 / 13 or so build rows with the same b */
+    REQUIRE ( expected == vector<string> { "100" } );
+
+    for (size_t threads: { 1, 3 }) {
+        unique_ptr<ExecNode> plan = joinedCount();
+        PipelineExecutor executor(*plan);
+        /* into the aggregate, into the hash table, into the count, and into the result */
+        REQUIRE ( executor.pipelineCount() == 4 );
+        REQUIRE ( tableStrings(executor.run(threads)) == expected );
+    }
+}
+
+TEST_CASE ( "PipelineExecutor without pipeline breakers", "[pipeline]" ) {
+    auto plan = make_unique<ExecLimit>(
+        make_unique<ExecFilter>(make_unique<ExecScan>(numberRows(1000)),
+            CompareExpr::make(VarExpr::make(1), ConstExpr::makeInt(0), EQ)),
+        5, 2);
+    PipelineExecutor executor(*plan);
+    REQUIRE ( executor.pipelineCount() == 1 );
+    REQUIRE ( tableStrings(executor.run()) ==
+              vector<string> { "26,0,26", "39,0,39", "52,0,52", "65,0,65", "78,0,78" } );
+    REQUIRE_THROWS ( executor.run() );
+}
@@ -1,9 +1,15 @@
 #include "catch.hpp"
+#include "counting_expr.h"
+#include "int_tables.h"
 #include <expr.h>
 #include <tuple.h>
 #include <rowstore.h>
 #include <memory>
+#include <map>
+#include <cstring>
 #include <climits>
+#include <algorithm>
+#include <functional>
 using namespace std;
 
 const int testdata_1[] = {1, 2,
@@ -30,6 +36,17 @@ vector<TupleP> createIntTable(size_t rows, size_t cols, const int *values) {
     return result;
 }
 
+vector<TupleP> createIntTable(size_t cols, const vector<int> &values) {
+    return createIntTable(values.size() / cols, cols, values.data());
+}
+
+vector<string> tableStrings(const vector<TupleP> &rows) {
+    vector<string> result;
+    for (const TupleP &tuple: rows)
+        result.push_back(tupleToString(*tuple));
+    return result;
+}
+
 TEST_CASE ( "ExecScan", "[rowstore]" ) {
     auto scanNode = make_unique<ExecScan>(createIntTable(rows_1, cols_1, testdata_1));
 
@@ -99,6 +116,169 @@ TEST_CASE ( "Aggregate Sum(int), a constant", "[rowstore]" ) {
     REQUIRE ( (fieldValue<int>(result[2], 0) == 3 && fieldValue<int>(result[2], 1) == 1) );
 }
 
+TEST_CASE ( "Aggregate Sum(int), pre-aggregation flushes", "[rowstore]" ) {
+    /* 200 hot keys, followed by 700 keys which overflow the pre-agg table */
+    vector<int> data;
+    map<int, int> expected;
+    for (int i = 0; i < 4000; i++) {
+        int key = (i < 2000) ? i % 200 : 200 + i % 700;
+        data.push_back(key);
+        data.push_back(i);
+        expected[key] += i;
+    }
+
+    vector<int> groupBy { 0 };
+    vector<unique_ptr<AggFuncCall>> aggFuncCalls;
+    aggFuncCalls.push_back(AggSum<int>::makeCall(VarExpr::make(1)));
+    auto aggNode = make_unique<ExecAgg>(
+        make_unique<ExecScan>(createIntTable(4000, 2, data.data())),
+        groupBy, move(aggFuncCalls));
+
+    vector<TupleP> result = aggNode->eval();
+
+    REQUIRE ( aggNode->preAggregating() );
+    REQUIRE ( result.size() == expected.size() );
+    size_t r = 0;
+    for (const auto &p: expected) {
+        REQUIRE ( fieldValue<int>(result[r], 0) == p.first );
+        REQUIRE ( fieldValue<int>(result[r], 1) == p.second );
+        r++;
+    }
+}
+
+TEST_CASE ( "Aggregate Sum(int), pre-aggregation backs off on unique keys", "[rowstore]" ) {
+    vector<int> data;
+    for (int i = 0; i < 5000; i++) {
+        data.push_back(5000 - i);
+        data.push_back(i);
+    }
+
+    vector<int> groupBy { 0 };
+    vector<unique_ptr<AggFuncCall>> aggFuncCalls;
+    aggFuncCalls.push_back(AggSum<int>::makeCall(VarExpr::make(1)));
+    auto aggNode = make_unique<ExecAgg>(
+        make_unique<ExecScan>(createIntTable(5000, 2, data.data())),
+        groupBy, move(aggFuncCalls));
+
+    vector<TupleP> result = aggNode->eval();
+
+    REQUIRE ( !aggNode->preAggregating() );
+    REQUIRE ( result.size() == 5000 );
+    for (int r = 0; r < 5000; r++) {
+        REQUIRE ( fieldValue<int>(result[r], 0) == r + 1 );
+        REQUIRE ( fieldValue<int>(result[r], 1) == 4999 - r );
+    }
+}
+
+TEST_CASE ( "Aggregate Sum(int), sorted input", "[rowstore]" ) {
+    /* project the columns, so that child tuples are reused between calls */
+    std::vector<std::unique_ptr<Expr>> exprs;
+    exprs.push_back(VarExpr::make(0));
+    exprs.push_back(VarExpr::make(1));
+    auto projectNode = make_unique<ExecProject>(
+        make_unique<ExecScan>(createIntTable(rows_1, cols_1, testdata_1)),
+        move(exprs)
+    );
+
+    vector<int> groupBy { 0 };
+    vector<unique_ptr<AggFuncCall>> aggFuncCalls;
+    aggFuncCalls.push_back(AggSum<int>::makeCall(VarExpr::make(1)));
+    auto aggNode = make_unique<ExecAgg>(move(projectNode), groupBy,
+                                        move(aggFuncCalls), AGG_SORTED);
+
+    /* groups are returned one by one as their key changes */
+    Tuple *first = aggNode->nextTuple();
+    REQUIRE ( first != NULL );
+    REQUIRE ( (datumValue<int>(*(*first)[0]) == 1 && datumValue<int>(*(*first)[1]) == 5) );
+
+    vector<TupleP> result = aggNode->eval();
+    REQUIRE ( result.size() == 2 );
+    REQUIRE ( (fieldValue<int>(result[0], 0) == 2 && fieldValue<int>(result[0], 1) == 11) );
+    REQUIRE ( (fieldValue<int>(result[1], 0) == 3 && fieldValue<int>(result[1], 1) == 0) );
+    REQUIRE ( aggNode->nextTuple() == NULL );
+}
+
+TEST_CASE ( "Aggregate Sum(int), sorted input without group by", "[rowstore]" ) {
+    vector<int> groupBy {};
+    vector<unique_ptr<AggFuncCall>> aggFuncCalls;
+    aggFuncCalls.push_back(AggSum<int>::makeCall(VarExpr::make(1)));
+    auto aggNode = make_unique<ExecAgg>(
+        make_unique<ExecScan>(vector<TupleP>()), groupBy,
+        move(aggFuncCalls), AGG_SORTED);
+
+    vector<TupleP> result = aggNode->eval();
+    REQUIRE ( result.size() == 1 );
+    REQUIRE ( fieldValue<int>(result[0], 0) == 0 );
+}
+
+TEST_CASE ( "Aggregate deterministic Sum(double), row and batch paths", "[rowstore]" ) {
+    vector<TupleP> input1, input2;
+    for (int i = 0; i < 5000; i++) {
+        double value = (i % 7 == 0) ? 1e12 / (i + 1) : 0.1 * i;
+        input1.push_back(make_unique<Tuple>());
+        input1.back()->push_back(make_unique<DoubleDatum>(value));
+        input2.push_back(cloneTuple(*input1.back()));
+    }
+
+    vector<int> groupBy {};
+    vector<unique_ptr<AggFuncCall>> batchCalls, rowCalls;
+    batchCalls.push_back(AggDeterministicSum::makeCall(VarExpr::make(0)));
+    rowCalls.push_back(AggDeterministicSum::makeCall(VarExpr::make(0)));
+
+    /* AGG_SORTED aggregates one row at a time */
+    ExecAgg batchAgg(make_unique<ExecScan>(move(input1)), groupBy, move(batchCalls));
+    ExecAgg rowAgg(make_unique<ExecScan>(move(input2)), groupBy, move(rowCalls), AGG_SORTED);
+
+    double batchSum = fieldValue<double>(batchAgg.eval()[0], 0);
+    double rowSum = fieldValue<double>(rowAgg.eval()[0], 0);
+    REQUIRE ( memcmp(&batchSum, &rowSum, sizeof(double)) == 0 );
+}
+
+TEST_CASE ( "Grouped deterministic Sum(double) doesn't depend on pre-aggregation", "[rowstore]" ) {
+    /* values whose compensated sum depends on the order of the lanes they go to */
+    const double values[] = { -0x1.8p-13, -0x1.fffffffffffffp+40, 0x1p-64, -0x1.cp-51,
+                              -0x1.fffffffffffffp+72, 0x1.fffffffffffffp+132, 0x1.cp-5,
+                              -0x1.fffffffffffffp+132, -0x1.fffffffffffffp-5 };
+    const int count = sizeof(values) / sizeof(values[0]);
+    /* 3000 groups don't fit the pre-aggregation table, whose partial sums are merged */
+    vector<TupleP> sortedInput, hashedInput;
+    for (int g = 0; g < 3000; g++) {
+        for (int i = 0; i < count; i++) {
+            sortedInput.push_back(make_unique<Tuple>());
+            sortedInput.back()->push_back(make_unique<IntDatum>(g));
+            sortedInput.back()->push_back(make_unique<DoubleDatum>(values[i]));
+        }
+    }
+    /*
+     * the hashed aggregate reads three values of each group at a time, so
+     * the pre-aggregation table is flushed with partial sums of three
+     */
+    for (int i = 0; i < count; i += 3) {
+        for (int g = 0; g < 3000; g++) {
+            for (int j = i; j < i + 3; j++)
+                hashedInput.push_back(cloneTuple(*sortedInput[g * count + j]));
+        }
+    }
+
+    vector<unique_ptr<AggFuncCall>> sortedCalls, hashedCalls;
+    sortedCalls.push_back(AggDeterministicSum::makeCall(VarExpr::make(1)));
+    hashedCalls.push_back(AggDeterministicSum::makeCall(VarExpr::make(1)));
+    ExecAgg sortedAgg(make_unique<ExecScan>(move(sortedInput)), vector<int> { 0 },
+                      move(sortedCalls), AGG_SORTED);
+    ExecAgg hashedAgg(make_unique<ExecScan>(move(hashedInput)), vector<int> { 0 },
+                      move(hashedCalls));
+
+    vector<TupleP> expected = sortedAgg.eval();
+    REQUIRE ( expected.size() == 3000 );
+    double expectedSum = datumValue<double>(*(*expected[0])[1]);
+    vector<TupleP> result = hashedAgg.eval();
+    REQUIRE ( result.size() == 3000 );
+    for (const TupleP &row: result) {
+        double sum = datumValue<double>(*(*row)[1]);
+        REQUIRE ( memcmp(&sum, &expectedSum, sizeof(double)) == 0 );
+    }
+}
+
 TEST_CASE ( "ExecFilter", "[rowstore]" ) {
     auto filterNode = make_unique<ExecFilter>(
         make_unique<ExecScan>(createIntTable(rows_1, cols_1, testdata_1)),
@@ -133,6 +313,207 @@ TEST_CASE ( "ExecProject", "[rowstore]" ) {
     }
 }
 
+/* an IntDatum which counts its copies */
+class CountedIntDatum: public IntDatum {
+public:
+    CountedIntDatum(int value, size_t &clones): IntDatum(value), clones(clones) {}
+    unique_ptr<Datum> clone() const override {
+        clones++;
+        return make_unique<CountedIntDatum>(value, clones);
+    }
+private:
+    size_t &clones;
+};
+
+TEST_CASE ( "ExecProject batches copy no datums per surviving row", "[rowstore]" ) {
+    size_t clones = 0;
+    vector<TupleP> tuples;
+    for (int i = 0; i < 5000; i++) {
+        TupleP tuple = make_unique<Tuple>();
+        tuple->push_back(make_unique<IntDatum>(i % 50));
+        tuple->push_back(make_unique<CountedIntDatum>(i, clones));
+        tuples.push_back(move(tuple));
+    }
+    size_t evaluations = 0;
+    vector<unique_ptr<Expr>> exprs;
+    exprs.push_back(make_unique<CountingExpr>(VarExpr::make(1), evaluations));
+    ExecProject projectNode(
+        make_unique<ExecFilter>(
+            make_unique<ExecScan>(move(tuples)),
+            /* attrs[0] < 25, half of the rows */
+            CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(25), LT)),
+        move(exprs));
+
+    vector<Tuple *> batch;
+    vector<int> seen;
+    size_t largestBatch = 0;
+    while (projectNode.nextBatch(batch)) {
+        largestBatch = max(largestBatch, batch.size());
+        for (Tuple *tuple: batch)
+            seen.push_back(static_cast<IntDatum *>((*tuple)[0].get())->value);
+    }
+    REQUIRE ( seen.size() == 2500 );
+    REQUIRE ( evaluations == 2500 );
+    /* one datum per output slot, overwritten by the following batches */
+    REQUIRE ( largestBatch < 2500 );
+    REQUIRE ( clones == largestBatch );
+    for (size_t i = 0; i < seen.size(); i++)
+        REQUIRE ( seen[i] == i / 25 * 50 + i % 25 );
+}
+
+/* a * (b + 1), counting its evaluations */
+static unique_ptr<Expr> countedProduct(size_t &evaluations) {
+    return make_unique<CountingExpr>(
+        MultExpr::make(VarExpr::make(0), ArithExpr::make(VarExpr::make(1), ConstExpr::makeInt(1), ADD)),
+        evaluations);
+}
+
+/*
+ * select sum(a * (b + 1)), sum(a * (b + 1) * b) from (i % 100, i % 7)
+ * where a * (b + 1) > 300, whose rows are read as configured by run
+ */
+static vector<string> sharedProductSums(bool eliminate, AggStrategy strategy,
+                                        size_t &evaluations,
+                                        const function<vector<TupleP>(ExecNode &)> &run)
+{
+    vector<int> values;
+    for (int i = 0; i < 3000; i++) {
+        values.push_back(i % 100);
+        values.push_back(i % 7);
+    }
+    vector<unique_ptr<AggFuncCall>> aggs;
+    aggs.push_back(AggSum<int>::makeCall(countedProduct(evaluations)));
+    aggs.push_back(AggSum<int>::makeCall(
+        MultExpr::make(countedProduct(evaluations), VarExpr::make(1))));
+    ExecAgg aggNode(
+        make_unique<ExecFilter>(
+            make_unique<ExecScan>(createIntTable(3000, 2, values.data())),
+            CompareExpr::make(countedProduct(evaluations), ConstExpr::makeInt(300), GT)),
+        vector<int> {}, move(aggs), strategy);
+    if (eliminate)
+        aggNode.eliminateCommonExprs();
+    vector<string> result;
+    for (const TupleP &tuple: run(aggNode))
+        result.push_back(tupleToString(*tuple));
+    return result;
+}
+
+TEST_CASE ( "Common subexpressions are evaluated once per row", "[rowstore]" ) {
+    size_t unshared = 0;
+    vector<string> expected = sharedProductSums(false, AGG_HASHED, unshared,
+        [](ExecNode &node) { return node.eval(); });
+    REQUIRE ( unshared > 3000 );
+
+    vector<function<vector<TupleP>(ExecNode &)>> runs {
+        [](ExecNode &node) { return node.eval(); },
+        [](ExecNode &node) { node.fusePipelines(); return node.eval(); },
+        [](ExecNode &node) { return PipelineExecutor(node).run(); }
+    };
+    for (auto &run: runs) {
+        size_t evaluations = 0;
+        REQUIRE ( sharedProductSums(true, AGG_HASHED, evaluations, run) == expected );
+        REQUIRE ( evaluations == 3000 );
+    }
+
+    /* the row path of sorted aggregates */
+    size_t evaluations = 0;
+    REQUIRE ( sharedProductSums(true, AGG_SORTED, evaluations, runs[0]) == expected );
+    REQUIRE ( evaluations == 3000 );
+
+    /* projections share with the filters below them too */
+    evaluations = 0;
+    vector<unique_ptr<Expr>> exprs;
+    exprs.push_back(countedProduct(evaluations));
+    exprs.push_back(MultExpr::make(countedProduct(evaluations), VarExpr::make(0)));
+    vector<int> values { 1, 2, 3, 4, 5, 6 };
+    ExecProject projectNode(
+        make_unique<ExecFilter>(
+            make_unique<ExecScan>(createIntTable(3, 2, values.data())),
+            CompareExpr::make(countedProduct(evaluations), ConstExpr::makeInt(5), GT)),
+        move(exprs));
+    projectNode.eliminateCommonExprs();
+    vector<TupleP> projected = projectNode.eval();
+    REQUIRE ( projected.size() == 2 );
+    REQUIRE ( tupleToString(*projected[0]) == "15,45" );
+    REQUIRE ( tupleToString(*projected[1]) == "35,175" );
+    REQUIRE ( evaluations == 3 );
+}
+
+TEST_CASE ( "ExecLimit stops its input after the last row", "[rowstore]" ) {
+    vector<int> values;
+    for (int i = 0; i < 10000; i++)
+        values.push_back(i);
+
+    for (size_t offset: { 0, 5, 2000, 20000 }) {
+        for (size_t limit: { 0, 1, 3, 1500 }) {
+            auto scanNode = make_unique<ExecScan>(createIntTable(values.size(), 1, values.data()));
+            ExecScan *scan = scanNode.get();
+            ExecLimit limitNode(move(scanNode), limit, offset);
+
+            vector<TupleP> result = limitNode.eval();
+            size_t expected = offset < values.size() ? min(limit, values.size() - offset) : 0;
+            REQUIRE ( result.size() == expected );
+            for (size_t i = 0; i < result.size(); i++)
+                REQUIRE ( fieldValue<int>(result[i], 0) == offset + i );
+            /* the scan has been stopped, even though it has rows left */
+            REQUIRE ( scan->nextTuple() == NULL );
+        }
+    }
+
+    /* batches are cut at the offset and the limit */
+    ExecLimit limitNode(make_unique<ExecScan>(createIntTable(values.size(), 1, values.data())),
+                        1500, 1000);
+    vector<Tuple *> batch;
+    vector<int> seen;
+    while (limitNode.nextBatch(batch)) {
+        for (Tuple *tuple: batch)
+            seen.push_back(static_cast<IntDatum *>((*tuple)[0].get())->value);
+    }
+    REQUIRE ( seen.size() == 1500 );
+    REQUIRE ( seen.front() == 1000 );
+    REQUIRE ( seen.back() == 2499 );
+}
+
+/* sum(a * b), count(*) of the rows with a < 40, grouped by a % 3 if grouped */
+static vector<string> projectedSums(bool grouped, bool fused) {
+    vector<int> values;
+    for (int i = 0; i < 5000; i++) {
+        values.push_back(i % 97);
+        values.push_back(i % 13);
+    }
+    auto filterNode = make_unique<ExecFilter>(
+        make_unique<ExecScan>(createIntTable(5000, 2, values.data())),
+        CompareExpr::make(VarExpr::make(0), ConstExpr::makeInt(40), LT));
+    /* (a * b, b, a) */
+    vector<unique_ptr<Expr>> exprs;
+    exprs.push_back(MultExpr::make(VarExpr::make(0), VarExpr::make(1)));
+    exprs.push_back(VarExpr::make(1));
+    exprs.push_back(VarExpr::make(0));
+    auto projectNode = make_unique<ExecProject>(move(filterNode), move(exprs));
+    /* b != 0 */
+    auto nonZero = make_unique<ExecFilter>(move(projectNode),
+        make_unique<NotExpr>(CompareExpr::make(VarExpr::make(1), ConstExpr::makeInt(0), EQ)));
+
+    vector<unique_ptr<AggFuncCall>> aggs;
+    aggs.push_back(AggSum<int>::makeCall(VarExpr::make(0)));
+    aggs.push_back(AggCount::makeStarCall());
+    ExecAgg agg(move(nonZero), grouped ? vector<int> { 1 } : vector<int> {}, move(aggs));
+    if (fused)
+        agg.fusePipelines();
+    vector<string> rows;
+    for (const TupleP &tuple: agg.eval())
+        rows.push_back(tupleToString(*tuple));
+    return rows;
+}
+
+TEST_CASE ( "Fused pipelines give the same results as pulling rows", "[rowstore]" ) {
+    for (bool grouped: { false, true }) {
+        vector<string> expected = projectedSums(grouped, false);
+        REQUIRE ( expected.size() == (grouped ? 12 : 1) );
+        REQUIRE ( projectedSums(grouped, true) == expected );
+    }
+}
+
 const std::string lineitem_sample[] = {
     "1|155190|7706|1|17|21168.23|0.04|0.02|N|O|1996-03-13|1996-02-12|1996-03-22|DELIVER IN PERSON|TRUCK|egular courts above the",
     "1|67310|7311|2|36|45983.16|0.09|0.06|N|O|1996-04-12|1996-02-28|1996-04-20|TAKE BACK RETURN|MAIL|ly final dependencies: slyly bold ",
@@ -167,7 +548,10 @@ const Schema lineitem_schema {
 const int l_quantity = 4;
 const int l_extendedprice = 5;
 const int l_discount = 6;
+const int l_returnflag = 8;
+const int l_linestatus = 9;
 const int l_shipdate = 10;
+const int l_shipmode = 14;
 
 TEST_CASE ( "TPCH Query 6", "[rowstore]" ) {
     auto scanNode = make_unique<ExecScan>(
@@ -218,3 +602,28 @@ TEST_CASE ( "TPCH Query 6", "[rowstore]" ) {
     REQUIRE ( result.size() == 1 );
     REQUIRE ( tupleToString(*result[0]) == "9187.61" );
 }
+
+TEST_CASE ( "TPCH Query 1 style aggregates", "[rowstore]" ) {
+    auto scanNode = make_unique<ExecScan>(
+        parseTuples(lineitem_sample, lineitem_rows, lineitem_schema, '|'));
+
+    vector<unique_ptr<AggFuncCall>> aggFuncCalls;
+    aggFuncCalls.push_back(AggSum<double>::makeCall(VarExpr::make(l_quantity)));
+    aggFuncCalls.push_back(AggSum<double>::makeCall(VarExpr::make(l_extendedprice)));
+    aggFuncCalls.push_back(AggAvg<double>::makeCall(VarExpr::make(l_quantity)));
+    aggFuncCalls.push_back(AggAvg<double>::makeCall(VarExpr::make(l_discount)));
+    aggFuncCalls.push_back(AggCount::makeStarCall());
+    aggFuncCalls.push_back(AggMin<Date>::makeCall(VarExpr::make(l_shipdate)));
+    aggFuncCalls.push_back(AggMax<Date>::makeCall(VarExpr::make(l_shipdate)));
+    aggFuncCalls.push_back(AggMin<string>::makeCall(VarExpr::make(l_shipmode)));
+
+    vector<int> groupBy { l_returnflag, l_linestatus };
+
+    auto aggNode = make_unique<ExecAgg>(move(scanNode), groupBy, move(aggFuncCalls));
+
+    vector<TupleP> result = aggNode->eval();
+    REQUIRE ( result.size() == 3 );
+    REQUIRE ( tupleToString(*result[0]) == "A,F,142.00,206668.09,28.40,0.07,5,1992-04-27,1994-08-08,AIR" );
+    REQUIRE ( tupleToString(*result[1]) == "N,O,234.00,282449.39,23.40,0.07,10,1996-01-10,1997-01-28,AIR" );
+    REQUIRE ( tupleToString(*result[2]) == "R,F,163.00,208243.51,32.60,0.06,5,1993-11-09,1994-10-31,AIR" );
+}
@@ -0,0 +1,191 @@
+#include "catch.hpp"
+#include "int_tables.h"
+#include <expr.h>
+#include <tuple.h>
+#include <rowstore.h>
+#include <sort.h>
+#include <memory>
+#include <algorithm>
+using namespace std;
+
+static vector<SortKey> sortKeys(const vector<int> &columns, const vector<bool> &descending) {
+    vector<SortKey> result;
+    for (size_t i = 0; i < columns.size(); i++)
+        result.push_back({ VarExpr::make(columns[i]), descending[i] });
+    return result;
+}
+
+static vector<string> rowStrings(ExecNode &node) {
+    vector<string> rows;
+    Tuple *tuple;
+    while ((tuple = node.nextTuple()))
+        rows.push_back(tupleToString(*tuple));
+    return rows;
+}
+
+TEST_CASE ( "ExecSort, keys and directions", "[sort]" ) {
+    vector<TupleP> rows = createIntTable(3, { 2, 1, 0,
+                                       1, 5, 1,
+                                       2, 3, 2,
+                                       1, 5, 3,
+                                       0, 4, 4 });
+    (*rows[4])[0] = make_unique<NullDatum>();
+
+    /* ORDER BY a, b DESC, with NULLs first */
+    ExecSort sort(make_unique<ExecScan>(move(rows)), sortKeys({0, 1}, {false, true}));
+
+    /* ties keep their input order */
+    REQUIRE ( rowStrings(sort) == vector<string>({ "NULL,4,4", "1,5,1", "1,5,3",
+                                                   "2,3,2", "2,1,0" }) );
+    REQUIRE ( sort.spilledRuns() == 0 );
+}
+
+TEST_CASE ( "ExecSort spills runs which don't fit in the memory budget", "[sort]" ) {
+    vector<int> values;
+    for (int i = 0; i < 20000; i++) {
+        values.push_back(i * 7919 % 1000);
+        values.push_back(i);
+    }
+
+    ExecSort inMemory(make_unique<ExecScan>(createIntTable(2, values)),
+                      sortKeys({0}, {true}));
+    vector<string> expected = rowStrings(inMemory);
+    REQUIRE ( inMemory.spilledRuns() == 0 );
+
+    /* budgets for a few runs, and for more runs than a single merge takes */
+    for (size_t budget: { 1 << 20, 16 << 10 }) {
+        ExecSort external(make_unique<ExecScan>(createIntTable(2, values)),
+                          sortKeys({0}, {true}), budget);
+        REQUIRE ( rowStrings(external) == expected );
+        REQUIRE ( external.spilledRuns() > 1 );
+    }
+}
+
+TEST_CASE ( "ExecSort hands over its rows in order, in memory and from spilled runs", "[sort]" ) {
+    vector<int> values;
+    for (int i = 0; i < 5000; i++) {
+        values.push_back(i * 7919 % 100);
+        values.push_back(i);
+    }
+    ExecSort reference(make_unique<ExecScan>(createIntTable(2, values)), sortKeys({0}, {false}));
+    vector<string> expected = rowStrings(reference);
+
+    for (size_t budget: { ExecSort::defaultMemoryBudget, (size_t) 16 << 10 }) {
+        ExecSort sort(make_unique<ExecScan>(createIntTable(2, values)), sortKeys({0}, {false}), budget);
+        /* taken and borrowed rows can be mixed */
+        vector<string> rows;
+        rows.push_back(tupleToString(*sort.takeTuple()));
+        rows.push_back(tupleToString(*sort.nextTuple()));
+        for (const TupleP &tuple: sort.eval())
+            rows.push_back(tupleToString(*tuple));
+        REQUIRE ( rows == expected );
+        REQUIRE ( !sort.takeTuple() );
+    }
+}
+
+TEST_CASE ( "ExecSort keeps values exact through spilled runs", "[sort]" ) {
+    vector<TupleP> rows;
+    for (int i = 0; i < 1000; i++) {
+        TupleP row = make_unique<Tuple>();
+        row->push_back(make_unique<DoubleDatum>(1.0 / (i + 1)));
+        row->push_back(make_unique<StringDatum>(string(i % 7, 'x') + "|\n"));
+        row->push_back(make_unique<DateDatum>(Date(1990 + i % 10, 1 + i % 12, 1 + i % 28)));
+        rows.push_back(move(row));
+    }
+    ExecSort sort(make_unique<ExecScan>(move(rows)), sortKeys({0}, {false}), 4096);
+
+    double last = 0;
+    size_t count = 0;
+    Tuple *tuple;
+    while ((tuple = sort.nextTuple())) {
+        double value = datumValue<double>(*(*tuple)[0]);
+        REQUIRE ( value > last );
+        int i = (int) (1.0 / value + 0.5) - 1;
+        REQUIRE ( value == 1.0 / (i + 1) );
+        REQUIRE ( datumValue<string>(*(*tuple)[1]) == string(i % 7, 'x') + "|\n" );
+        REQUIRE ( datumValue<Date>(*(*tuple)[2]) == Date(1990 + i % 10, 1 + i % 12, 1 + i % 28) );
+        last = value;
+        count++;
+    }
+    REQUIRE ( count == 1000 );
+    REQUIRE ( sort.spilledRuns() > 1 );
+}
+
+/* sorts (key, row number) rows on the key, and checks the order is stable */
+static void requireStableSort(vector<TupleP> rows, size_t threads) {
+    vector<SortKey> keys;
+    keys.push_back({ VarExpr::make(0), false });
+    sortTable(rows, keys, threads);
+    bool ordered = true;
+    for (size_t i = 1; i < rows.size(); i++) {
+        const Datum &previous = *(*rows[i - 1])[0], &current = *(*rows[i])[0];
+        if (current < previous)
+            ordered = false;
+        else if (!(previous < current))
+            ordered &= fieldValue<int>(rows[i - 1], 1) < fieldValue<int>(rows[i], 1);
+    }
+    REQUIRE ( ordered );
+}
+
+TEST_CASE ( "sortTable, radix and sample sort paths", "[sort]" ) {
+    size_t n = parallelSortRows + 1000;
+    vector<TupleP> dates, strings;
+    for (size_t i = 0; i < n; i++) {
+        int k = i * 7919 % 5003;
+        TupleP date = make_unique<Tuple>();
+        date->push_back(make_unique<DateDatum>(Date(1992 + k % 7, 1 + k % 12, 1 + k % 28)));
+        date->push_back(make_unique<IntDatum>(i));
+        dates.push_back(move(date));
+        /* keys of different lengths, so they can't be radix sorted */
+        TupleP str = make_unique<Tuple>();
+        str->push_back(make_unique<StringDatum>(to_string(k)));
+        str->push_back(make_unique<IntDatum>(i));
+        strings.push_back(move(str));
+    }
+    (*strings[10])[0] = make_unique<NullDatum>();
+
+    requireStableSort(move(dates), 4);
+    for (size_t threads: { 1, 4 }) {
+        vector<TupleP> copy;
+        for (const TupleP &row: strings)
+            copy.push_back(cloneTuple(*row));
+        requireStableSort(move(copy), threads);
+    }
+}
+
+TEST_CASE ( "ExecTopN returns the first rows of ExecSort", "[sort]" ) {
+    vector<int> values;
+    for (int i = 0; i < 5000; i++) {
+        values.push_back(i * 7919 % 300);
+        values.push_back(i);
+    }
+    ExecSort sort(make_unique<ExecScan>(createIntTable(2, values)), sortKeys({0}, {true}));
+    vector<string> sorted = rowStrings(sort);
+
+    for (size_t limit: { 0, 1, 10, 100, 6000 }) {
+        ExecTopN topN(make_unique<ExecScan>(createIntTable(2, values)), sortKeys({0}, {true}), limit);
+        vector<string> expected(sorted.begin(), sorted.begin() + min(limit, sorted.size()));
+        REQUIRE ( rowStrings(topN) == expected );
+    }
+}
+
+TEST_CASE ( "ExecTopN merges the top rows of parallel inputs", "[sort]" ) {
+    vector<int> values;
+    for (int i = 0; i < 6000; i++) {
+        values.push_back(i * 7919 % 500);
+        values.push_back(i);
+    }
+    ExecTopN single(make_unique<ExecScan>(createIntTable(2, values)), sortKeys({0, 1}, {false, true}), 50);
+    vector<string> expected = rowStrings(single);
+
+    /* the same rows split over three inputs */
+    vector<unique_ptr<ExecNode>> inputs;
+    vector<vector<SortKey>> inputKeys;
+    for (size_t part = 0; part < 3; part++) {
+        vector<int> partValues(values.begin() + part * 4000, values.begin() + (part + 1) * 4000);
+        inputs.push_back(make_unique<ExecScan>(createIntTable(2, partValues)));
+        inputKeys.push_back(sortKeys({0, 1}, {false, true}));
+    }
+    ExecTopN parallel(move(inputs), move(inputKeys), 50);
+    REQUIRE ( rowStrings(parallel) == expected );
+}
@@ -141,3 +141,82 @@ TEST_CASE ( "tuple (de)serialization, escaping", "[tuples]" ) {
     REQUIRE ( tupleToString(*tuple2, '|') == "2|\\||32" );
 
 }
+
+TEST_CASE( "Tuples survive the binary encoding", "[tuples]" ) {
+    Tuple tuple;
+    tuple.push_back(make_unique<IntDatum>(-7));
+    tuple.push_back(make_unique<BigIntDatum>(LLONG_MAX));
+    tuple.push_back(make_unique<DoubleDatum>(0.1));
+    tuple.push_back(make_unique<StringDatum>("a,b\\c"));
+    tuple.push_back(make_unique<DateDatum>(Date(1998, 12, 1)));
+    tuple.push_back(make_unique<BoolDatum>(true));
+    tuple.push_back(make_unique<NullDatum>());
+
+    string encoded;
+    writeTuple(encoded, tuple);
+    writeTuple(encoded, Tuple());
+    const char *pos = encoded.data();
+    TupleP decoded = readTuple(pos);
+    TupleP empty = readTuple(pos);
+
+    REQUIRE ( pos == encoded.data() + encoded.size() );
+    REQUIRE ( empty->empty() );
+    REQUIRE ( decoded->size() == tuple.size() );
+    for (size_t i = 0; i < tuple.size(); i++)
+        REQUIRE ( *(*decoded)[i] == *tuple[i] );
+    REQUIRE ( datumValue<double>(*(*decoded)[2]) == 0.1 );
+    REQUIRE ( (*decoded)[6]->isNull() );
+    REQUIRE ( tupleMemoryUsage(tuple) > tuple.size() * sizeof(DatumP) );
+}
+
+/* normalized keys must sort like the datums, for every pair of values */
+static void requireNormalizedOrder(const vector<DatumP> &values) {
+    for (bool descending: { false, true }) {
+        for (const DatumP &a: values) {
+            for (const DatumP &b: values) {
+                string x, y;
+                normalizeDatum(x, *a, descending);
+                normalizeDatum(y, *b, descending);
+                bool less = descending ? *b < *a : *a < *b;
+                bool equal = !(*a < *b) && !(*b < *a);
+                REQUIRE ( (x < y) == less );
+                REQUIRE ( (x == y) == equal );
+            }
+        }
+    }
+}
+
+TEST_CASE( "Normalized keys sort like datums", "[tuples]" ) {
+    vector<DatumP> ints, bigints, doubles, dates, strings;
+    for (int v: { INT_MIN, -70000, -1, 0, 1, 255, 256, 70000, INT_MAX })
+        ints.push_back(make_unique<IntDatum>(v));
+    for (long long v: { LLONG_MIN, -(1LL << 40), -1LL, 0LL, 1LL, 1LL << 40, LLONG_MAX })
+        bigints.push_back(make_unique<BigIntDatum>(v));
+    for (double v: { -1e300, -2.5, -1e-300, -0.0, 0.0, 1e-300, 0.1, 2.5, 1e300 })
+        doubles.push_back(make_unique<DoubleDatum>(v));
+    for (Date v: { Date(1992, 1, 2), Date(1992, 2, 1), Date(1998, 12, 31), Date(1, 1, 1) })
+        dates.push_back(make_unique<DateDatum>(v));
+    for (string v: { string(""), string("a"), string("a\0", 2), string("a\0b", 3),
+                     string("ab"), string("b"), string("\xff"), string("MAIL") })
+        strings.push_back(make_unique<StringDatum>(v));
+    for (vector<DatumP> *values: { &ints, &bigints, &doubles, &dates, &strings }) {
+        values->push_back(make_unique<NullDatum>());
+        requireNormalizedOrder(*values);
+    }
+}
+
+TEST_CASE( "Normalized multi-column keys sort column by column", "[tuples]" ) {
+    /* (a, b DESC) */
+    string x, y;
+    normalizeDatum(x, StringDatum("ab"));
+    normalizeDatum(x, IntDatum(1), true);
+    normalizeDatum(y, StringDatum("ab"));
+    normalizeDatum(y, IntDatum(2), true);
+    REQUIRE ( y < x );
+
+    /* a shorter string in the first column wins over the second column */
+    string z;
+    normalizeDatum(z, StringDatum("a"));
+    normalizeDatum(z, IntDatum(9), true);
+    REQUIRE ( z < y );
+}